@@ -0,0 +1,2564 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef COMPARISON_H_
+#define COMPARISON_H_
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <stdlib.h>
+#include "Digest.hpp"
+#include "FileError.hpp"
+#include "MappedFile.hpp"
+#include "NumberParser.hpp"
+#include "RingBuffer.hpp"
+#include "Statistics.hpp"
+#include "StructuredFile.hpp"
+#include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+// Allowed difference between two decimals, compared on their scaled integers without floating point
+class Tolerance {
+public:
+   enum class Kind {
+      Exact, Absolute, Relative
+   };
+   Kind kind = Kind::Exact;
+   // Absolute in units of the last place of the column, Relative in millionths of the reference
+   util::Decimal128 value = 0;
+
+   static constexpr int64_t millionths = 1000000;
+
+   // Whether percent is kept as it is by relative: zero or between a millionth and 100%
+   static bool isValidRelative(double percent) {
+      return percent == 0.0 || (percent > 0.0 && percent <= 100.0 && llround(percent*(millionths/100)) > 0);
+   }
+
+   // Relative tolerance in percent of the reference, see isValidRelative
+   static Tolerance relative(double percent) {
+      Tolerance tolerance;
+      tolerance.kind = Kind::Relative;
+      tolerance.value = llround(percent*(millionths/100));
+      return tolerance;
+   }
+
+   bool allows(util::Decimal128 input, util::Decimal128 reference) const {
+      if (input == reference) {
+         return true;
+      }
+      // Both magnitudes are below 10^38, so the difference fits
+      unsigned __int128 difference = input > reference ? static_cast<unsigned __int128>(input) - static_cast<unsigned __int128>(reference) : static_cast<unsigned __int128>(reference) - static_cast<unsigned __int128>(input);
+      switch (kind) {
+         case(Kind::Exact):
+         return false;
+         case(Kind::Absolute):
+         return difference <= static_cast<unsigned __int128>(value);
+         case(Kind::Relative): {
+            // difference <= |reference|*value/10^6 without overflowing, the remainder keeps it exact
+            unsigned __int128 magnitude = reference < 0 ? -static_cast<unsigned __int128>(reference) : static_cast<unsigned __int128>(reference);
+            unsigned __int128 factor = static_cast<unsigned __int128>(value);
+            return difference <= magnitude/millionths*factor + magnitude%millionths*factor/millionths;
+         }
+      }
+      return false;
+   }
+};
+//---------------------------------------------------------------------------
+class Attribute {
+public:
+   enum class Type {
+      Integer, BigInt, Varchar, Char, Decimal, Date
+   };
+   string name;
+   Type type;
+   int length = -1;
+   int precision = -1;
+   bool null = true;
+   // Results are ordered by the sort key attributes, records with equal sort keys may appear in any order
+   bool sortKey = false;
+   // Of decimals, overrides the epsilon of the command line
+   Tolerance tolerance;
+};
+//---------------------------------------------------------------------------
+enum class ParserState {
+   Name, Type, TypeLength, TypePrecision, NullInfo, EndOfAttribute
+};
+//---------------------------------------------------------------------------
+class SchemaException : public runtime_error {
+public:
+   // Line of the error, and the field if it concerns a single one
+   uint64_t line;
+   int field;
+
+   SchemaException(string message, uint64_t line = 0, int field = -1) : runtime_error(message), line(line), field(field) {}
+};
+//---------------------------------------------------------------------------
+class SchemaInputFileException : public runtime_error {
+public:
+   SchemaInputFileException(string message) : runtime_error(message) {}
+};
+//---------------------------------------------------------------------------
+class SchemaReferenceFileException : public runtime_error {
+public:
+   SchemaReferenceFileException(string message) : runtime_error(message) {}
+};
+//---------------------------------------------------------------------------
+// The errors of a full scan instead of only the first one: the messages of the first errors up to a limit, the number
+// of errors per field and the first and last line with an error
+class MismatchCollector {
+public:
+   struct Mismatch {
+      // -1 for errors of whole records
+      int field;
+      uint64_t line;
+      string message;
+   };
+
+private:
+   size_t maximumMessages;
+   vector<Mismatch> messages;
+   // The last entry counts errors of whole records, e.g. missing fields or results
+   vector<uint64_t> fieldCounts;
+   uint64_t count;
+   uint64_t firstLine;
+   uint64_t lastLine;
+
+public:
+   MismatchCollector(size_t maximumMessages, int numberOfFields) : maximumMessages(maximumMessages), fieldCounts(numberOfFields + 1), count(0), firstLine(0), lastLine(0) {}
+
+   // Messages are only kept for the first errors, there is no need to build them for the others
+   bool needsMessage() const {
+      return messages.size() < maximumMessages;
+   }
+
+   void add(int field, uint64_t line, const string& message) {
+      if (needsMessage()) {
+         messages.push_back(Mismatch{field, line, message});
+      }
+      ++fieldCounts[field < 0 ? fieldCounts.size() - 1 : field];
+      firstLine = count == 0 ? line : min(firstLine, line);
+      lastLine = max(lastLine, line);
+      ++count;
+   }
+
+   void add(const SchemaException& e) {
+      add(e.field, e.line, e.what());
+   }
+
+   // Adds the errors of a later part of the same file
+   void append(const MismatchCollector& other) {
+      for (auto& message : other.messages) {
+         if (needsMessage()) {
+            messages.push_back(message);
+         }
+      }
+      for (size_t field = 0; field != fieldCounts.size(); ++field) {
+         fieldCounts[field] += other.fieldCounts[field];
+      }
+      if (other.count) {
+         firstLine = count == 0 ? other.firstLine : min(firstLine, other.firstLine);
+         lastLine = max(lastLine, other.lastLine);
+         count += other.count;
+      }
+   }
+
+   uint64_t getCount() const {
+      return count;
+   }
+
+   size_t getMaximumMessages() const {
+      return maximumMessages;
+   }
+
+   const vector<Mismatch>& getMismatches() const {
+      return messages;
+   }
+
+   // The last entry counts errors of whole records
+   const vector<uint64_t>& getFieldCounts() const {
+      return fieldCounts;
+   }
+
+   void print(const vector<string>& fieldNames, ostream& out) const {
+      for (auto& mismatch : messages) {
+         out << mismatch.message << endl;
+      }
+      out << count << " mismatch(es) in lines " << firstLine << " to " << lastLine << ", the first " << messages.size() << " shown" << endl;
+      for (size_t field = 0; field != fieldCounts.size(); ++field) {
+         if (fieldCounts[field]) {
+            out << "   " << (field < fieldNames.size() ? fieldNames[field] : "(record)") << ": " << fieldCounts[field] << endl;
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+class Schema {
+private:
+   friend class ComparisonPlan;
+   friend class DigestComparison;
+   friend class CompiledReference;
+   friend class TieGroupComparison;
+
+   static constexpr size_t minimumChunkSize = 1 << 20;
+
+   vector<Attribute> attributes;
+   int numberOfAttributes;
+
+   // The tolerance of a decimal: absolute (0.01), relative to the reference (0.5%) or in units in the last place (2 ulp)
+   static Tolerance parseTolerance(string text, const Attribute& attribute) {
+      if (attribute.type != Attribute::Type::Decimal) {
+         throw SchemaException("only decimals can have a tolerance");
+      }
+      Tolerance tolerance;
+      tolerance.kind = Tolerance::Kind::Absolute;
+      const string unitsInLastPlace = "ulp";
+      const string declared = text;
+      // Percent with four fraction digits are millionths
+      int scale = attribute.precision;
+      if (!text.empty() && text.back() == '%') {
+         tolerance.kind = Tolerance::Kind::Relative;
+         text.pop_back();
+         scale = 4;
+      } else if (text.size() >= unitsInLastPlace.size() && text.compare(text.size() - unitsInLastPlace.size(), unitsInLastPlace.size(), unitsInLastPlace) == 0) {
+         text.erase(text.size() - unitsInLastPlace.size());
+         scale = 0;
+      }
+      if (util::parseDecimal(text, scale, tolerance.value) != util::ParseStatus::Success || tolerance.value < 0) {
+         throw SchemaException("invalid tolerance");
+      }
+      // Rounding would silently change the tolerance, e.g. 0.001 of a decimal(12,2) to an exact comparison
+      size_t point = text.find('.');
+      size_t lastDigit = text.find_last_not_of("0 \t\r");
+      if (point != string::npos && lastDigit != string::npos && lastDigit > point && lastDigit - point > static_cast<size_t>(scale)) {
+         throw SchemaException("tolerance " + declared + " would be rounded, it may have at most " + to_string(scale) + " fraction digits");
+      }
+      if (tolerance.kind == Tolerance::Kind::Relative && tolerance.value > Tolerance::millionths) {
+         throw SchemaException("relative tolerance exceeds 100%");
+      }
+      return tolerance;
+   }
+
+   // The rest of an attribute line: [not null | null] [sort key] [tolerance T]
+   static void parseNullInfo(string info, Attribute& attribute) {
+      const string toleranceKeyword = "tolerance ";
+      size_t tolerance = info.rfind(toleranceKeyword);
+      if (tolerance != string::npos && (tolerance == 0 || info[tolerance - 1] == ' ')) {
+         attribute.tolerance = parseTolerance(info.substr(tolerance + toleranceKeyword.size()), attribute);
+         info.erase(tolerance);
+         if (!info.empty() && info.back() == ' ') {
+            info.pop_back();
+         }
+      }
+      const string sortKey = "sort key";
+      if (info.size() >= sortKey.size() && info.compare(info.size() - sortKey.size(), sortKey.size(), sortKey) == 0) {
+         attribute.sortKey = true;
+         info.erase(info.size() - sortKey.size());
+         if (!info.empty() && info.back() == ' ') {
+            info.pop_back();
+         }
+      }
+      if (info == "not null") {
+         attribute.null = false;
+      } else if (info == "null") {
+         attribute.null = true;
+      } else if (info == "") {
+         attribute.null = true;
+      } else {
+         throw SchemaException("invalid null info");
+      }
+   }
+
+   void throwError(util::StructuredFile& inputFile, string message, int field = -1) {
+      throwError(inputFile.getFilename(), inputFile.getLineNumber(), message, field);
+   }
+
+   // Reports malformed and out of range values of the util parsers as SchemaException
+   static void checkParsed(util::ParseStatus status, const char* type) {
+      if (status == util::ParseStatus::Malformed) {
+         throw SchemaException(string("invalid ") + type);
+      } else if (status == util::ParseStatus::Overflow) {
+         throw SchemaException(string(type) + " out of range");
+      }
+   }
+
+   template <typename T, util::ParseStatus (*parse)(string_view, T&)>
+   T parseField(string_view field, const char* type) {
+      T value;
+      checkParsed(parse(field, value), type);
+      return value;
+   }
+
+   util::Decimal128 parseDecimal(string_view field, int precision) {
+      util::Decimal128 value;
+      checkParsed(util::parseDecimal(field, precision, value), "decimal");
+      return value;
+   }
+
+   // The tolerance of the column, or the epsilon of the command line as relative tolerance if it has none
+   static Tolerance toleranceOf(const Attribute& attribute, double epsilon) {
+      if (attribute.tolerance.kind != Tolerance::Kind::Exact || epsilon == 0.0) {
+         return attribute.tolerance;
+      }
+      return Tolerance::relative(epsilon);
+   }
+
+   // Appends the decimal with precision fraction digits
+   static void appendDecimal(util::Decimal128 decimal, int precision, string& row) {
+      char digits[48];
+      char* position = digits + sizeof(digits);
+      unsigned __int128 magnitude = decimal < 0 ? -static_cast<unsigned __int128>(decimal) : static_cast<unsigned __int128>(decimal);
+      for (int digit = 0; digit <= precision || magnitude != 0; ++digit) {
+         if (digit == precision) {
+            *--position = '.';
+         }
+         *--position = '0' + magnitude%10;
+         magnitude /= 10;
+      }
+      if (decimal < 0) {
+         *--position = '-';
+      }
+      row.append(position, digits + sizeof(digits));
+   }
+
+   template <typename T, util::ParseStatus (*parse)(string_view, T&)>
+   bool compareParsed(string_view input, string_view reference, const char* type) {
+      T inputValue;
+      try {
+         inputValue = parseField<T, parse>(input, type);
+      } catch (SchemaException& e) {
+         throw SchemaInputFileException(e.what());
+      }
+      T referenceValue;
+      try {
+         referenceValue = parseField<T, parse>(reference, type);
+      } catch (SchemaException& e) {
+         throw SchemaReferenceFileException(e.what());
+      }
+      return inputValue == referenceValue;
+   }
+
+   bool compareInteger(string_view input, string_view reference) {
+      return compareParsed<int32_t, util::parseInt32>(input, reference, "integer");
+   }
+
+   bool compareBigInt(string_view input, string_view reference) {
+      return compareParsed<int64_t, util::parseInt64>(input, reference, "integer");
+   }
+
+   static inline string_view ltrim(string_view input) {
+      while (!input.empty() && isspace(input.front())) {
+         input.remove_prefix(1);
+      }
+      return input;
+   }
+
+   static inline string_view rtrim(string_view input) {
+      while (!input.empty() && isspace(input.back())) {
+         input.remove_suffix(1);
+      }
+      return input;
+   }
+
+   static inline string_view trim(string_view input) {
+      return ltrim(rtrim(input));
+   }
+
+   bool compareVarchar(string_view input, string_view reference, int length, bool trimStrings) {
+      if (trimStrings) {
+         input = trim(input);
+         reference = trim(reference);
+      }
+      if (input.length() > static_cast<size_t>(length)) {
+         throw SchemaInputFileException("varchar field exceeds length");
+      }
+      if (reference.length() > static_cast<size_t>(length)) {
+         throw SchemaReferenceFileException("varchar field exceeds length");
+      }
+      return input == reference;
+   }
+
+   bool compareChar(string_view input, string_view reference, int length, bool trimStrings) {
+      if (input.length() > static_cast<size_t>(length)) {
+         throw SchemaInputFileException("character field exceeds length");
+      }
+      if (reference.length() > static_cast<size_t>(length)) {
+         throw SchemaReferenceFileException("character field exceeds length");
+      }
+      if (trimStrings) {
+         return trim(input) == trim(reference);
+      } else {
+         return input == reference;
+      }
+   }
+
+   bool compareDecimal(string_view input, string_view reference, const Attribute& attribute, double epsilon) {
+      util::Decimal128 inputDecimal;
+      try {
+         inputDecimal = parseDecimal(input, attribute.precision);
+      } catch (SchemaException& e) {
+         throw SchemaInputFileException(e.what());
+      }
+      util::Decimal128 referenceDecimal;
+      try {
+         referenceDecimal = parseDecimal(reference, attribute.precision);
+      } catch (SchemaException& e) {
+         throw SchemaReferenceFileException(e.what());
+      }
+      return toleranceOf(attribute, epsilon).allows(inputDecimal, referenceDecimal);
+   }
+
+   bool compareDate(string_view input, string_view reference) {
+      return compareParsed<int32_t, util::parseDate>(input, reference, "date");
+   }
+
+   // Appends the value in a canonical form, so that values that compare equal have the same representation
+   void normalize(int attributeNumber, string_view value, bool trimStrings, string& row) {
+      const Attribute& attribute = attributes[attributeNumber];
+      if (value == "null") {
+         if (!attribute.null) {
+            throw SchemaException("null not allowed");
+         }
+         row += "null";
+         return;
+      }
+      char buffer[32];
+      switch (attribute.type) {
+         case(Attribute::Type::Integer):
+         row.append(buffer, to_chars(buffer, buffer + sizeof(buffer), parseField<int32_t, util::parseInt32>(value, "integer")).ptr);
+         break;
+         case(Attribute::Type::BigInt):
+         row.append(buffer, to_chars(buffer, buffer + sizeof(buffer), parseField<int64_t, util::parseInt64>(value, "integer")).ptr);
+         break;
+         case(Attribute::Type::Varchar):
+         if (trimStrings) {
+            value = trim(value);
+         }
+         if (value.length() > static_cast<size_t>(attribute.length)) {
+            throw SchemaException("varchar field exceeds length");
+         }
+         row.append(value);
+         break;
+         case(Attribute::Type::Char):
+         if (value.length() > static_cast<size_t>(attribute.length)) {
+            throw SchemaException("character field exceeds length");
+         }
+         row.append(trimStrings ? trim(value) : value);
+         break;
+         case(Attribute::Type::Decimal):
+         appendDecimal(parseDecimal(value, attribute.precision), attribute.precision, row);
+         break;
+         case(Attribute::Type::Date):
+         // Dates have a fixed layout, the validated text is canonical
+         parseField<int32_t, util::parseDate>(value, "date");
+         row.append(util::trimSpaces(value));
+         break;
+      }
+   }
+
+   bool compare(int attributeNumber, string_view input, string_view reference, double epsilon, bool trimStrings) {
+      const Attribute& attribute = attributes[attributeNumber];
+      if (attribute.null) {
+         if (input == "null" && reference == "null") {
+            return true;
+         }
+      } else {
+         if (input == "null") {
+            throw SchemaInputFileException("null not allowed");
+         }
+         if (reference == "null") {
+            throw SchemaReferenceFileException("null not allowed");
+         }
+      }
+      switch (attribute.type) {
+         case(Attribute::Type::Integer):
+         return compareInteger(input, reference);
+         case(Attribute::Type::BigInt):
+         return compareBigInt(input, reference);
+         case(Attribute::Type::Varchar):
+         return compareVarchar(input, reference, attribute.length, trimStrings);
+         case(Attribute::Type::Char):
+         return compareChar(input, reference, attribute.length, trimStrings);
+         case(Attribute::Type::Decimal):
+         return compareDecimal(input, reference, attribute, epsilon);
+         case(Attribute::Type::Date):
+         return compareDate(input, reference);
+      }
+      return false;
+   }
+
+   void parseAttributes(const char* begin, const char* end) {
+      numberOfAttributes = 0;
+      unique_ptr<stringstream> stream = unique_ptr<stringstream>(new stringstream);
+      ParserState state = ParserState::Name;
+      Attribute attribute;
+      auto position = begin;
+      while (position != end) {
+         char character = *position;
+         switch (state) {
+            case (ParserState::Name):
+            if (character == ' ') {
+               attribute.name = stream->str();
+               stream = unique_ptr<stringstream>(new stringstream);
+               state = ParserState::Type;
+               ++position;
+               continue;
+            }
+            break;
+            case (ParserState::Type):
+            if (character == ' ' || character == '(' || character == '\n') {
+               if (stream->str() == "integer") {
+                  attribute.type = Attribute::Type::Integer;
+               } else if (stream->str() == "bigint") {
+                  attribute.type = Attribute::Type::BigInt;
+               } else if (stream->str() == "varchar") {
+                  attribute.type = Attribute::Type::Varchar;
+                  attribute.length = 1;
+               } else if (stream->str() == "char") {
+                  attribute.type = Attribute::Type::Char;
+                  attribute.length = 1;
+               } else if (stream->str() == "decimal") {
+                  attribute.type = Attribute::Type::Decimal;
+                  attribute.length = 4;
+                  attribute.precision = 2;
+               } else if (stream->str() == "date") {
+                  attribute.type = Attribute::Type::Date;
+               } else {
+                  throw SchemaException(string("unknown type ") + stream->str());
+               }
+               stream = unique_ptr<stringstream>(new stringstream);
+               if (character == '(') {
+                  state = ParserState::TypeLength;
+               } else if (character == ' ') {
+                  state = ParserState::NullInfo;
+               } else if (character == '\n') {
+                  state = ParserState::NullInfo;
+                  continue;
+               }
+               ++position;
+               continue;
+            }
+            break;
+            case (ParserState::TypeLength):
+            if (character == ' ' || character == ',' || character == '\n') {
+               if (attribute.type == Attribute::Type::Integer || attribute.type == Attribute::Type::BigInt || attribute.type == Attribute::Type::Date) {
+                  throw SchemaException("type cannot have a length");
+               }
+               attribute.length = stoi(stream->str());
+               stream = unique_ptr<stringstream>(new stringstream);
+               if (character == ',') {
+                  state = ParserState::TypePrecision;
+               } else if (character == ' ') {
+                  state = ParserState::NullInfo;
+               } else if (character == '\n') {
+                  state = ParserState::NullInfo;
+                  continue;
+               }
+               ++position;
+               continue;
+            }
+            break;
+            case (ParserState::TypePrecision):
+            if (character == ' ' || character == '\n') {
+               if (attribute.type != Attribute::Type::Decimal) {
+                  throw SchemaException("type cannot have a precision");
+               }
+               attribute.precision = stoi(stream->str());
+               stream = unique_ptr<stringstream>(new stringstream);
+               state = ParserState::NullInfo;
+               if (character == '\n') {
+                  continue;
+               }
+               ++position;
+               continue;
+            }
+            break;
+            case (ParserState::NullInfo):
+            if (character == '\n') {
+               parseNullInfo(stream->str(), attribute);
+               stream = unique_ptr<stringstream>(new stringstream);
+               state = ParserState::EndOfAttribute;
+               continue;
+            }
+            break;
+            case (ParserState::EndOfAttribute):
+            if (character == '\n') {
+               attributes.push_back(attribute);
+               attribute = Attribute();
+               ++numberOfAttributes;
+               state = ParserState::Name;
+               ++position;
+               continue;
+            } else {
+               throw SchemaException("missing newline at end of attribute");
+            }
+            break;
+         }
+         *stream << character;
+         ++position;
+      }
+      // Finish last attribute
+      switch (state) {
+         case (ParserState::Type):
+         if (stream->str() == "integer") {
+            attribute.type = Attribute::Type::Integer;
+         } else if (stream->str() == "bigint") {
+            attribute.type = Attribute::Type::BigInt;
+         } else if (stream->str() == "varchar") {
+            attribute.type = Attribute::Type::Varchar;
+            attribute.length = 1;
+         } else if (stream->str() == "char") {
+            attribute.type = Attribute::Type::Char;
+            attribute.length = 1;
+         } else if (stream->str() == "decimal") {
+            attribute.type = Attribute::Type::Decimal;
+            attribute.length = 4;
+            attribute.precision = 2;
+         } else if (stream->str() == "date") {
+            attribute.type = Attribute::Type::Date;
+         } else {
+            throw SchemaException(string("unknown type ") + stream->str());
+         }
+         break;
+         case (ParserState::TypeLength):
+         if (attribute.type == Attribute::Type::Integer || attribute.type == Attribute::Type::BigInt || attribute.type == Attribute::Type::Date) {
+            throw SchemaException("type cannot have a length");
+         }
+         attribute.length = stoi(stream->str());
+         break;
+         case (ParserState::TypePrecision):
+         if (attribute.type != Attribute::Type::Decimal) {
+            throw SchemaException("type cannot have a precision");
+         }
+         attribute.precision = stoi(stream->str());
+         break;
+         case (ParserState::NullInfo):
+         parseNullInfo(stream->str(), attribute);
+         default:
+         break;
+      }
+      if (state != ParserState::Name) {
+         attributes.push_back(attribute);
+         ++numberOfAttributes;
+      }
+   }
+
+public:
+   static void throwError(string filename, uint64_t line, string message) {
+      throwMismatch(filename, line, message, -1);
+   }
+
+   void throwError(string filename, uint64_t line, string message, int field) {
+      throwMismatch(filename, line, field > -1 ? attributes[field].name + ": " + message : message, field);
+   }
+
+   // Like throwError, but without the name of the field in the message
+   static void throwMismatch(string filename, uint64_t line, string message, int field) {
+      throw SchemaException(filename + ":" + to_string(line) + "\t" + message, line, field);
+   }
+
+   int getNumberOfAttributes() {
+      return numberOfAttributes;
+   }
+
+   // Changes with the names, types, sort keys and tolerances of the attributes, used to detect outdated files derived from the schema
+   util::Digest fingerprint() {
+      util::Digest digest;
+      for (auto& attribute : attributes) {
+         digest.add(attribute.name);
+         digest.add(to_string(int(attribute.type)) + " " + to_string(attribute.length) + " " + to_string(attribute.precision) + " " + to_string(attribute.null) + " " + to_string(attribute.sortKey));
+         unsigned __int128 tolerance = static_cast<unsigned __int128>(attribute.tolerance.value);
+         digest.add(to_string(int(attribute.tolerance.kind)) + " " + to_string(uint64_t(tolerance >> 64)) + " " + to_string(uint64_t(tolerance)));
+      }
+      return digest;
+   }
+
+   vector<int> getSortKeys() {
+      vector<int> sortKeys;
+      for (int field = 0; field != numberOfAttributes; ++field) {
+         if (attributes[field].sortKey) {
+            sortKeys.push_back(field);
+         }
+      }
+      return sortKeys;
+   }
+
+   bool hasTolerances() {
+      for (auto& attribute : attributes) {
+         if (attribute.tolerance.kind != Tolerance::Kind::Exact) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   vector<string> getAttributeNames() {
+      vector<string> names;
+      for (auto& attribute : attributes) {
+         names.push_back(attribute.name);
+      }
+      return names;
+   }
+
+   // Normalizes the remaining fields of the current record into row (see normalize)
+   void normalizeRecord(util::StructuredFile& file, bool trimStrings, string& row) {
+      row.clear();
+      for (int field = 0; field != numberOfAttributes; ++field) {
+         string_view value;
+         if (file.nextField(value) == util::StructuredFile::Status::EndOfRecord) {
+            throwError(file, "too few fields");
+         }
+         if (field != 0) {
+            row += '\t';
+         }
+         try {
+            normalize(field, value, trimStrings, row);
+         } catch (SchemaException& e) {
+            throwError(file, e.what(), field);
+         }
+      }
+      if (file.hasMoreFields()) {
+         throwError(file, "too many fields");
+      }
+   }
+
+   // Normalizes a record that consists of a single empty field
+   void normalizeEmptyRecord(string filename, uint64_t line, bool trimStrings, string& row) {
+      row.clear();
+      if (numberOfAttributes != 1) {
+         throwError(filename, line, "too few fields");
+      }
+      try {
+         normalize(0, string_view(), trimStrings, row);
+      } catch (SchemaException& e) {
+         throwError(filename, line, e.what(), 0);
+      }
+   }
+
+   Schema(string filename) {
+      util::MappedFile<char> file(filename);
+      parseAttributes(file.begin(), file.end());
+   }
+
+   // A schema that is already in memory, in the format of schema files
+   Schema(const char* begin, const char* end) {
+      parseAttributes(begin, end);
+   }
+
+   // Stops at the first error, or scans the whole files if there are mismatches to collect
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, double epsilon, bool trimStrings, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr);
+
+   // Compares the fields of the current records of both files
+   void compareRecord(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, double epsilon, bool trimStrings) {
+      using Status = util::StructuredFile::Status;
+      for (int field = 0; field != numberOfAttributes; ++field) {
+         string_view input;
+         if (inputFile.nextField(input) == Status::EndOfRecord) {
+            throwError(inputFile, "too few fields");
+         }
+         string_view reference;
+         if (referenceFile.nextField(reference) == Status::EndOfRecord) {
+            throwError(referenceFile, "too few fields");
+         }
+         try {
+            if (!compare(field, input, reference, epsilon, trimStrings)) {
+               throwMismatch(inputFile.getFilename(), inputFile.getLineNumber(), string("expected ") + string(reference) + string(" got ") + string(input), field);
+            }
+         } catch(SchemaInputFileException& e) {
+            throwError(inputFile, e.what(), field);
+         } catch(SchemaReferenceFileException& e) {
+            throwError(referenceFile, e.what(), field);
+         }
+      }
+      if (inputFile.hasMoreFields()) {
+         throwError(inputFile, "too many fields");
+      }
+      if (referenceFile.hasMoreFields()) {
+         throwError(referenceFile, "too many fields");
+      }
+   }
+
+   // Splits [begin, end) at record boundaries into at most maximumRanges ranges of about equal size, returns the
+   // beginnings of the ranges followed by end. Only touches the pages at the boundaries.
+   static vector<const char*> splitAtRecords(util::StructuredFile& file, const char* begin, const char* end, unsigned maximumRanges) {
+      size_t rangeSize = max<size_t>((end - begin)/maximumRanges, minimumChunkSize);
+      vector<const char*> boundaries{begin};
+      while (boundaries.size() < maximumRanges && size_t(end - boundaries.back()) > rangeSize + rangeSize/2) {
+         boundaries.push_back(file.skipRecord(boundaries.back() + rangeSize - 1));
+      }
+      if (boundaries.back() != end || boundaries.size() == 1) {
+         boundaries.push_back(end);
+      }
+      return boundaries;
+   }
+
+   // Calls function(task) for every task in [0, numberOfTasks) on at most numberOfThreads threads and waits for them
+   template <typename Function>
+   static void runInParallel(size_t numberOfTasks, unsigned numberOfThreads, Function function) {
+      util::ThreadPool pool(min<size_t>(numberOfTasks, numberOfThreads));
+      for (size_t task = 0; task != numberOfTasks; ++task) {
+         pool.schedule([&function, task]() { function(task); });
+      }
+   }
+
+   // Splits both files into record-aligned chunks with the same number of records and compares them on at most
+   // numberOfThreads threads. The records of the chunks of the reference and of ranges of the input are counted in
+   // parallel as well, so that no thread has to read both files before the comparison starts.
+   void compareInChunks(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, double epsilon, bool trimStrings, unsigned numberOfChunks, unsigned numberOfThreads, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) {
+      if (inputFile.isStreamed() || referenceFile.isStreamed()) {
+         compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+         return;
+      }
+      struct Chunk {
+         const char* inputBegin;
+         const char* inputEnd;
+         const char* referenceBegin;
+         const char* referenceEnd;
+         uint64_t precedingRecords;
+         exception_ptr exception;
+         unique_ptr<MismatchCollector> mismatches;
+      };
+      vector<const char*> referenceBoundaries = splitAtRecords(referenceFile, referenceFile.dataBegin(), referenceFile.dataEnd(), numberOfChunks);
+      vector<const char*> inputBoundaries = splitAtRecords(inputFile, inputFile.dataBegin(), inputFile.dataEnd(), numberOfChunks);
+      size_t numberOfReferenceChunks = referenceBoundaries.size() - 1;
+      size_t numberOfInputRanges = inputBoundaries.size() - 1;
+      vector<uint64_t> referenceRecords(numberOfReferenceChunks);
+      vector<uint64_t> inputRecords(numberOfInputRanges);
+      runInParallel(numberOfReferenceChunks + numberOfInputRanges, numberOfThreads, [&](size_t task) {
+         if (task < numberOfReferenceChunks) {
+            referenceRecords[task] = referenceFile.countRecords(referenceBoundaries[task], referenceBoundaries[task + 1]);
+         } else {
+            task -= numberOfReferenceChunks;
+            inputRecords[task] = inputFile.countRecords(inputBoundaries[task], inputBoundaries[task + 1]);
+         }
+      });
+      // Records before every chunk of the reference and every range of the input
+      vector<uint64_t> precedingInputRecords(numberOfInputRanges);
+      for (size_t range = 1; range != numberOfInputRanges; ++range) {
+         precedingInputRecords[range] = precedingInputRecords[range - 1] + inputRecords[range - 1];
+      }
+      vector<Chunk> chunks(numberOfReferenceChunks);
+      for (size_t chunkNumber = 0; chunkNumber != numberOfReferenceChunks; ++chunkNumber) {
+         Chunk& chunk = chunks[chunkNumber];
+         chunk.referenceBegin = referenceBoundaries[chunkNumber];
+         chunk.referenceEnd = referenceBoundaries[chunkNumber + 1];
+         chunk.precedingRecords = chunkNumber ? chunks[chunkNumber - 1].precedingRecords + referenceRecords[chunkNumber - 1] : 0;
+         chunk.inputEnd = inputFile.dataEnd();
+         if (mismatches) {
+            chunk.mismatches = make_unique<MismatchCollector>(mismatches->getMaximumMessages(), numberOfAttributes);
+         }
+      }
+      // The input chunks start at the same record as the reference chunks, found from the range that contains it
+      chunks[0].inputBegin = inputBoundaries[0];
+      runInParallel(numberOfReferenceChunks - 1, numberOfThreads, [&](size_t task) {
+         Chunk& chunk = chunks[task + 1];
+         uint64_t records = chunk.precedingRecords;
+         size_t range = upper_bound(precedingInputRecords.begin(), precedingInputRecords.end(), records) - precedingInputRecords.begin() - 1;
+         chunk.inputBegin = inputFile.skipRecords(inputBoundaries[range], records - precedingInputRecords[range]);
+         chunks[task].inputEnd = chunk.inputBegin;
+      });
+      uint64_t inputHeader = inputFile.ignoreFirstLine;
+      uint64_t referenceHeader = referenceFile.ignoreFirstLine;
+      atomic<size_t> firstFailedChunk(chunks.size());
+      runInParallel(chunks.size(), numberOfThreads, [&](size_t chunkNumber) {
+         if (firstFailedChunk < chunkNumber) {
+            return;
+         }
+         Chunk& chunk = chunks[chunkNumber];
+         try {
+            util::StructuredFile inputChunk(inputFile, chunk.inputBegin, chunk.inputEnd, inputHeader + chunk.precedingRecords);
+            util::StructuredFile referenceChunk(referenceFile, chunk.referenceBegin, chunk.referenceEnd, referenceHeader + chunk.precedingRecords);
+            compare(inputChunk, referenceChunk, epsilon, trimStrings, statistics, chunk.mismatches.get());
+         } catch (...) {
+            chunk.exception = current_exception();
+            size_t failed = firstFailedChunk;
+            while (chunkNumber < failed && !firstFailedChunk.compare_exchange_weak(failed, chunkNumber));
+         }
+      });
+      // Report the first error in file order
+      for (auto& chunk : chunks) {
+         if (chunk.exception) {
+            rethrow_exception(chunk.exception);
+         }
+         if (mismatches) {
+            mismatches->append(*chunk.mismatches);
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// The reference and its schema compiled into a binary columnar file (reference.columns) that is mapped instead of
+// tokenizing and parsing the text. Integers and dates (days since 1970-01-01) are stored as 32 bit values, bigints as
+// 64 bit values, decimals as 128 bit integers scaled to the precision of the schema, strings as indexes into a per
+// column dictionary, and null as a bitmap per column. Records that could not be decoded are marked as
+// invalid and compared as text, the offsets of the records in the reference are kept for that and for messages.
+class CompiledReference {
+private:
+   static constexpr char magic[8] = {'v', 's', 'r', 'c', 'o', 'l', '0', '2'};
+
+   // All offsets are in bytes from the beginning of the file, sections are aligned to 8 bytes
+   struct Header {
+      char magic[8];
+      uint64_t referenceSize;
+      int64_t referenceModified;
+      uint64_t fingerprintLow;
+      uint64_t fingerprintHigh;
+      uint64_t numberOfRecords;
+      uint64_t numberOfColumns;
+      // numberOfRecords + 1 offsets of the records in the reference, the last one is the end of the data
+      uint64_t recordOffsets;
+      // Bitmap of the records that were decoded
+      uint64_t validRecords;
+   };
+
+   struct ColumnHeader {
+      uint64_t nulls;
+      // int32_t for Integer and Date, int64_t for BigInt, Decimal128 for Decimal, uint32_t dictionary indexes for
+      // Char and Varchar
+      uint64_t values;
+      // numberOfStrings + 1 uint64_t offsets into the string data
+      uint64_t dictionaryOffsets;
+      uint64_t dictionaryData;
+      uint64_t numberOfStrings;
+   };
+
+   unique_ptr<util::MappedFile<char>> file;
+   const Header* header;
+   const ColumnHeader* columnHeaders;
+   const uint64_t* recordOffsets;
+   const uint64_t* validRecords;
+   const char* referenceBegin;
+   uint64_t referenceSize;
+   // Char and Varchar columns, their dictionary indexes are checked per record
+   vector<size_t> stringColumns;
+
+   template <typename T>
+   const T* at(uint64_t offset) const {
+      return reinterpret_cast<const T*>(file->begin() + offset);
+   }
+
+   // True if count elements of elementSize bytes at the aligned offset lie within the file
+   bool contains(uint64_t offset, uint64_t count, uint64_t elementSize) const {
+      return offset%8 == 0 && offset <= file->size && count <= (file->size - offset)/elementSize;
+   }
+
+   // Checks that all sections lie within the file, so that a truncated or corrupt file is never read out of bounds
+   bool checkSections(Schema& schema) {
+      uint64_t records = header->numberOfRecords;
+      // Every record takes at least its offset, which also keeps the counts below from overflowing
+      if (records >= file->size || !contains(sizeof(Header), header->numberOfColumns, sizeof(ColumnHeader))) {
+         return false;
+      }
+      uint64_t words = records/64 + 1;
+      if (!contains(header->recordOffsets, records + 1, sizeof(uint64_t)) || !contains(header->validRecords, words, sizeof(uint64_t))) {
+         return false;
+      }
+      const ColumnHeader* columns = at<ColumnHeader>(sizeof(Header));
+      for (size_t field = 0; field != header->numberOfColumns; ++field) {
+         const ColumnHeader& column = columns[field];
+         uint64_t valueSize = 4;
+         switch (schema.attributes[field].type) {
+            case(Attribute::Type::Integer):
+            case(Attribute::Type::Date):
+            break;
+            case(Attribute::Type::BigInt):
+            valueSize = 8;
+            break;
+            case(Attribute::Type::Decimal):
+            valueSize = sizeof(util::Decimal128);
+            break;
+            case(Attribute::Type::Varchar):
+            case(Attribute::Type::Char): {
+               if (column.numberOfStrings >= file->size || !contains(column.dictionaryOffsets, column.numberOfStrings + 1, sizeof(uint64_t))) {
+                  return false;
+               }
+               const uint64_t* offsets = at<uint64_t>(column.dictionaryOffsets);
+               for (uint64_t string = 0; string != column.numberOfStrings; ++string) {
+                  if (offsets[string] > offsets[string + 1]) {
+                     return false;
+                  }
+               }
+               if (offsets[0] != 0 || !contains(column.dictionaryData, offsets[column.numberOfStrings], 1)) {
+                  return false;
+               }
+               stringColumns.push_back(field);
+               break;
+            }
+         }
+         if (!contains(column.nulls, words, sizeof(uint64_t)) || !contains(column.values, records, valueSize)) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   static bool test(const uint64_t* bitmap, uint64_t record) {
+      return bitmap[record/64] >> (record%64) & 1;
+   }
+
+   static Header expectedHeader(Schema& schema, util::StructuredFile& referenceFile) {
+      Header expected{};
+      memcpy(expected.magic, magic, sizeof(magic));
+      struct stat statistics;
+      if (stat(referenceFile.getFilename().c_str(), &statistics) == 0) {
+         expected.referenceSize = statistics.st_size;
+         expected.referenceModified = int64_t(statistics.st_mtim.tv_sec)*1000000000 + statistics.st_mtim.tv_nsec;
+      }
+      // The record offsets depend on whether the first line of the reference is skipped
+      util::Digest digest = schema.fingerprint();
+      digest.add(referenceFile.ignoreFirstLine ? "header" : "");
+      expected.fingerprintLow = digest.low;
+      expected.fingerprintHigh = digest.high;
+      expected.numberOfColumns = schema.getNumberOfAttributes();
+      return expected;
+   }
+
+   // Appends the section at an aligned position and returns its offset
+   static uint64_t append(string& output, const void* data, size_t size) {
+      output.append((8 - output.size()%8)%8, '\0');
+      uint64_t offset = output.size();
+      output.append(reinterpret_cast<const char*>(data), size);
+      return offset;
+   }
+
+   template <typename T>
+   static uint64_t append(string& output, const vector<T>& values) {
+      return append(output, values.data(), values.size()*sizeof(T));
+   }
+
+public:
+   static string filenameOf(string referenceFilename) {
+      return referenceFilename + ".columns";
+   }
+
+   // Writes the compiled reference next to it, returns the number of records
+   static uint64_t compile(Schema& schema, util::StructuredFile& referenceFile) {
+      struct Column {
+         vector<uint64_t> nulls;
+         vector<int32_t> integers;
+         vector<int64_t> bigInts;
+         vector<util::Decimal128> decimals;
+         vector<uint32_t> indexes;
+         unordered_map<string_view, uint32_t> dictionary;
+         vector<string_view> strings;
+      };
+      Header header = expectedHeader(schema, referenceFile);
+      vector<Column> columns(schema.getNumberOfAttributes());
+      vector<uint64_t> recordOffsets;
+      vector<uint64_t> validRecords;
+      const char* begin = referenceFile.dataBegin();
+      util::StructuredFile records(referenceFile, begin, referenceFile.dataEnd(), 0);
+      uint64_t record = 0;
+      for (; records.nextRecord() == util::StructuredFile::Status::Success; ++record) {
+         recordOffsets.push_back(records.getRecord().data() - begin);
+         if (record%64 == 0) {
+            validRecords.push_back(0);
+            for (auto& column : columns) {
+               column.nulls.push_back(0);
+            }
+         }
+         bool valid = true;
+         for (size_t field = 0; field != columns.size(); ++field) {
+            Column& column = columns[field];
+            const Attribute& attribute = schema.attributes[field];
+            string_view value;
+            if (records.nextField(value) == util::StructuredFile::Status::EndOfRecord) {
+               valid = false;
+            }
+            bool null = valid && value == "null";
+            if (null) {
+               column.nulls.back() |= uint64_t(1) << (record%64);
+            }
+            int32_t integer = 0;
+            int64_t bigInt = 0;
+            switch (attribute.type) {
+               case(Attribute::Type::Integer):
+               valid &= null || util::parseInt32(value, integer) == util::ParseStatus::Success;
+               column.integers.push_back(integer);
+               break;
+               case(Attribute::Type::Date):
+               valid &= null || util::parseDate(value, integer) == util::ParseStatus::Success;
+               column.integers.push_back(integer);
+               break;
+               case(Attribute::Type::BigInt):
+               valid &= null || util::parseInt64(value, bigInt) == util::ParseStatus::Success;
+               column.bigInts.push_back(bigInt);
+               break;
+               case(Attribute::Type::Decimal): {
+                  util::Decimal128 decimal = 0;
+                  valid &= null || util::parseDecimal(value, attribute.precision, decimal) == util::ParseStatus::Success;
+                  column.decimals.push_back(decimal);
+                  break;
+               }
+               case(Attribute::Type::Varchar):
+               case(Attribute::Type::Char): {
+                  auto entry = column.dictionary.emplace(valid ? value : string_view(), column.strings.size());
+                  if (entry.second) {
+                     column.strings.push_back(entry.first->first);
+                  }
+                  column.indexes.push_back(entry.first->second);
+                  break;
+               }
+            }
+         }
+         valid &= !records.hasMoreFields();
+         if (valid) {
+            validRecords.back() |= uint64_t(1) << (record%64);
+         }
+      }
+      recordOffsets.push_back(referenceFile.dataEnd() - begin);
+      header.numberOfRecords = record;
+      string output(sizeof(Header) + columns.size()*sizeof(ColumnHeader), '\0');
+      vector<ColumnHeader> columnHeaders(columns.size());
+      header.recordOffsets = append(output, recordOffsets);
+      header.validRecords = append(output, validRecords);
+      for (size_t field = 0; field != columns.size(); ++field) {
+         Column& column = columns[field];
+         ColumnHeader& columnHeader = columnHeaders[field];
+         columnHeader.nulls = append(output, column.nulls);
+         switch (schema.attributes[field].type) {
+            case(Attribute::Type::Integer):
+            case(Attribute::Type::Date):
+            columnHeader.values = append(output, column.integers);
+            break;
+            case(Attribute::Type::Decimal):
+            columnHeader.values = append(output, column.decimals);
+            break;
+            case(Attribute::Type::BigInt):
+            columnHeader.values = append(output, column.bigInts);
+            break;
+            case(Attribute::Type::Varchar):
+            case(Attribute::Type::Char): {
+               columnHeader.values = append(output, column.indexes);
+               vector<uint64_t> offsets{0};
+               string data;
+               for (auto& value : column.strings) {
+                  data.append(value);
+                  offsets.push_back(data.size());
+               }
+               columnHeader.dictionaryOffsets = append(output, offsets);
+               columnHeader.dictionaryData = append(output, data.data(), data.size());
+               columnHeader.numberOfStrings = column.strings.size();
+               break;
+            }
+         }
+      }
+      memcpy(&output[0], &header, sizeof(header));
+      memcpy(&output[sizeof(header)], columnHeaders.data(), columnHeaders.size()*sizeof(ColumnHeader));
+      string filename = filenameOf(referenceFile.getFilename());
+      string temporaryFilename;
+      FILE* outputFile = util::createSiblingFile(filename, temporaryFilename);
+      if (!outputFile) {
+         throw util::FileError("failed to write " + filename);
+      }
+      bool written = fwrite(output.data(), 1, output.size(), outputFile) == output.size();
+      if (fclose(outputFile) != 0 || !written || rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+         unlink(temporaryFilename.c_str());
+         throw util::FileError("failed to write " + filename);
+      }
+      return record;
+   }
+
+   // Maps the compiled form of the reference, returns false if there is none or it is outdated
+   bool open(Schema& schema, util::StructuredFile& referenceFile) {
+      string filename = filenameOf(referenceFile.getFilename());
+      struct stat statistics;
+      if (referenceFile.isStreamed() || stat(filename.c_str(), &statistics) != 0 || uint64_t(statistics.st_size) < sizeof(Header)) {
+         return false;
+      }
+      file = make_unique<util::MappedFile<char>>(filename);
+      header = at<Header>(0);
+      Header expected = expectedHeader(schema, referenceFile);
+      stringColumns.clear();
+      // The file may have changed since it was checked by stat
+      if (file->size < sizeof(Header) || memcmp(header, &expected, offsetof(Header, numberOfRecords)) != 0 || header->numberOfColumns != expected.numberOfColumns || !checkSections(schema)) {
+         file = nullptr;
+         return false;
+      }
+      columnHeaders = at<ColumnHeader>(sizeof(Header));
+      recordOffsets = at<uint64_t>(header->recordOffsets);
+      validRecords = at<uint64_t>(header->validRecords);
+      referenceBegin = referenceFile.dataBegin();
+      referenceSize = referenceFile.dataEnd() - referenceBegin;
+      return true;
+   }
+
+   // The compiled form of the reference, or null if there is none or it is outdated
+   static shared_ptr<CompiledReference> load(Schema& schema, util::StructuredFile& referenceFile) {
+      auto compiled = make_shared<CompiledReference>();
+      return compiled->open(schema, referenceFile) ? compiled : nullptr;
+   }
+
+   uint64_t getNumberOfRecords() const {
+      return header->numberOfRecords;
+   }
+
+   // Records with dictionary indexes out of range are invalid as well, they are compared as text
+   bool isValid(uint64_t record) const {
+      if (!test(validRecords, record)) {
+         return false;
+      }
+      for (size_t field : stringColumns) {
+         if (at<uint32_t>(columnHeaders[field].values)[record] >= columnHeaders[field].numberOfStrings) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   bool isNull(size_t field, uint64_t record) const {
+      return test(at<uint64_t>(columnHeaders[field].nulls), record);
+   }
+
+   int32_t getInteger(size_t field, uint64_t record) const {
+      return at<int32_t>(columnHeaders[field].values)[record];
+   }
+
+   int64_t getBigInt(size_t field, uint64_t record) const {
+      return at<int64_t>(columnHeaders[field].values)[record];
+   }
+
+   // Sections are only aligned to 8 bytes
+   util::Decimal128 getDecimal(size_t field, uint64_t record) const {
+      util::Decimal128 value;
+      memcpy(&value, at<char>(columnHeaders[field].values) + record*sizeof(value), sizeof(value));
+      return value;
+   }
+
+   string_view getString(size_t field, uint64_t record) const {
+      const ColumnHeader& column = columnHeaders[field];
+      uint32_t index = at<uint32_t>(column.values)[record];
+      const uint64_t* offsets = at<uint64_t>(column.dictionaryOffsets);
+      return string_view(at<char>(column.dictionaryData) + offsets[index], offsets[index + 1] - offsets[index]);
+   }
+
+   // The text of the record including its delimiter, offsets are clamped to the reference
+   const char* recordBegin(uint64_t record) const {
+      return referenceBegin + min(recordOffsets[record], referenceSize);
+   }
+
+   const char* recordEnd(uint64_t record) const {
+      return max(recordBegin(record), referenceBegin + min(recordOffsets[record + 1], referenceSize));
+   }
+};
+//---------------------------------------------------------------------------
+// The schema compiled into typed columns. Records are decoded in batches into per column buffers that are compared
+// column by column in type specialized loops. Records that cannot be decoded (wrong number of fields, invalid values,
+// null on one side) are compared with Schema::compareRecord, which reports the error. Records that are byte for byte
+// equal to the reference are neither decoded nor compared, only their number of fields is checked.
+class ComparisonPlan {
+private:
+   static constexpr size_t batchSize = 1024;
+   static constexpr size_t blockSize = 64;
+
+   struct Column {
+      Attribute::Type type;
+      bool null;
+      int length;
+      int precision;
+      // Integer and Date (days since 1970-01-01)
+      vector<int32_t> inputIntegers;
+      vector<int32_t> referenceIntegers;
+      // BigInt
+      vector<int64_t> inputBigInts;
+      vector<int64_t> referenceBigInts;
+      // Decimal, scaled by 10^precision
+      vector<util::Decimal128> inputDecimals;
+      vector<util::Decimal128> referenceDecimals;
+      Tolerance tolerance;
+      // Varchar and Char
+      vector<string_view> inputStrings;
+      vector<string_view> referenceStrings;
+      // Raw fields for error messages
+      vector<string_view> inputFields;
+      vector<string_view> referenceFields;
+   };
+
+   Schema& schema;
+   double epsilon;
+   bool trimStrings;
+   vector<Column> columns;
+   vector<uint64_t> lines;
+   util::Statistics* statistics;
+   util::ResourceSample batchBegin;
+   MismatchCollector* mismatches;
+   vector<pair<size_t, size_t>> differences;
+   // Decoded values of the reference are taken from the compiled reference if there is one
+   const CompiledReference* compiled;
+   util::StructuredFile* referenceTextFile;
+   vector<uint64_t> referenceRecords;
+   // Records since the last batch that were equal to the reference
+   uint64_t identicalRows;
+
+   bool hasAllFields(util::StructuredFile& file) {
+      string_view record = file.getRecord();
+      return size_t(count(record.begin(), record.end(), file.fieldDelimiter)) + 1 == columns.size();
+   }
+
+   // Returns false if the field has to be compared by the scalar path
+   bool decode(Column& column, size_t row, string_view input, string_view reference) {
+      column.inputFields[row] = input;
+      column.referenceFields[row] = reference;
+      bool inputNull = input == "null";
+      bool referenceNull = reference == "null";
+      if (inputNull || referenceNull) {
+         if (!column.null || !inputNull || !referenceNull) {
+            return false;
+         }
+         // Both null, store equal values
+         input = reference = string_view(column.type == Attribute::Type::Date ? "1970-01-01" : "0");
+      }
+      switch (column.type) {
+         case(Attribute::Type::Integer):
+         return util::parseInt32(input, column.inputIntegers[row]) == util::ParseStatus::Success && util::parseInt32(reference, column.referenceIntegers[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::BigInt):
+         return util::parseInt64(input, column.inputBigInts[row]) == util::ParseStatus::Success && util::parseInt64(reference, column.referenceBigInts[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::Date):
+         return util::parseDate(input, column.inputIntegers[row]) == util::ParseStatus::Success && util::parseDate(reference, column.referenceIntegers[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::Varchar):
+         if (trimStrings) {
+            input = Schema::trim(input);
+            reference = Schema::trim(reference);
+         }
+         if (input.length() > static_cast<size_t>(column.length) || reference.length() > static_cast<size_t>(column.length)) {
+            return false;
+         }
+         column.inputStrings[row] = input;
+         column.referenceStrings[row] = reference;
+         break;
+         case(Attribute::Type::Char):
+         if (input.length() > static_cast<size_t>(column.length) || reference.length() > static_cast<size_t>(column.length)) {
+            return false;
+         }
+         column.inputStrings[row] = trimStrings ? Schema::trim(input) : input;
+         column.referenceStrings[row] = trimStrings ? Schema::trim(reference) : reference;
+         break;
+         case(Attribute::Type::Decimal):
+         return util::parseDecimal(input, column.precision, column.inputDecimals[row]) == util::ParseStatus::Success && util::parseDecimal(reference, column.precision, column.referenceDecimals[row]) == util::ParseStatus::Success;
+      }
+      return true;
+   }
+
+   // Like decode, with the reference value of the field taken from the compiled reference
+   bool decodeCompiled(Column& column, size_t field, size_t row, string_view input, uint64_t record) {
+      column.inputFields[row] = input;
+      bool inputNull = input == "null";
+      bool referenceNull = compiled->isNull(field, record);
+      if (inputNull || referenceNull) {
+         if (!column.null || !inputNull || !referenceNull) {
+            return false;
+         }
+      }
+      bool null = inputNull && referenceNull;
+      switch (column.type) {
+         case(Attribute::Type::Integer):
+         column.referenceIntegers[row] = compiled->getInteger(field, record);
+         return null ? (column.inputIntegers[row] = column.referenceIntegers[row], true) : util::parseInt32(input, column.inputIntegers[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::BigInt):
+         column.referenceBigInts[row] = compiled->getBigInt(field, record);
+         return null ? (column.inputBigInts[row] = column.referenceBigInts[row], true) : util::parseInt64(input, column.inputBigInts[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::Date):
+         column.referenceIntegers[row] = compiled->getInteger(field, record);
+         return null ? (column.inputIntegers[row] = column.referenceIntegers[row], true) : util::parseDate(input, column.inputIntegers[row]) == util::ParseStatus::Success;
+         case(Attribute::Type::Varchar):
+         case(Attribute::Type::Char): {
+            string_view reference = null ? string_view("0") : compiled->getString(field, record);
+            if (null) {
+               input = reference;
+            }
+            // Varchar is trimmed before the length check, Char after it
+            if (column.type == Attribute::Type::Varchar && trimStrings) {
+               input = Schema::trim(input);
+               reference = Schema::trim(reference);
+            }
+            if (input.length() > static_cast<size_t>(column.length) || reference.length() > static_cast<size_t>(column.length)) {
+               return false;
+            }
+            column.inputStrings[row] = trimStrings ? Schema::trim(input) : input;
+            column.referenceStrings[row] = trimStrings ? Schema::trim(reference) : reference;
+            break;
+         }
+         case(Attribute::Type::Decimal):
+         column.referenceDecimals[row] = compiled->getDecimal(field, record);
+         return null ? (column.inputDecimals[row] = column.referenceDecimals[row], true) : util::parseDecimal(input, column.precision, column.inputDecimals[row]) == util::ParseStatus::Success;
+      }
+      return true;
+   }
+
+   bool decodeCompiledRecord(size_t row, util::StructuredFile& inputFile, uint64_t record) {
+      if (!compiled->isValid(record)) {
+         return false;
+      }
+      referenceRecords[row] = record;
+      try {
+         for (size_t field = 0; field != columns.size(); ++field) {
+            string_view input;
+            if (inputFile.nextField(input) == util::StructuredFile::Status::EndOfRecord || !decodeCompiled(columns[field], field, row, input, record)) {
+               return false;
+            }
+         }
+      } catch (SchemaException& e) {
+         return false;
+      }
+      return !inputFile.hasMoreFields();
+   }
+
+   // The text of the reference field, only read from the reference for messages if it is compiled
+   string referenceText(Column& column, size_t row) {
+      if (!compiled) {
+         return string(column.referenceFields[row]);
+      }
+      util::StructuredFile record(*referenceTextFile, compiled->recordBegin(referenceRecords[row]), compiled->recordEnd(referenceRecords[row]), 0);
+      record.nextRecord();
+      string_view field;
+      for (size_t skipped = 0; skipped <= size_t(&column - columns.data()); ++skipped) {
+         record.nextField(field);
+      }
+      return string(field);
+   }
+
+   bool decodeRecord(size_t row, util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      using Status = util::StructuredFile::Status;
+      try {
+         for (auto& column : columns) {
+            string_view input;
+            string_view reference;
+            if (inputFile.nextField(input) == Status::EndOfRecord || referenceFile.nextField(reference) == Status::EndOfRecord) {
+               return false;
+            }
+            if (!decode(column, row, input, reference)) {
+               return false;
+            }
+         }
+      } catch (SchemaException& e) {
+         return false;
+      }
+      return !inputFile.hasMoreFields() && !referenceFile.hasMoreFields();
+   }
+
+   // First row in [begin, rows) where the values differ, or rows
+   template <typename T>
+   static size_t findFirstDifference(const vector<T>& input, const vector<T>& reference, size_t begin, size_t rows) {
+      for (size_t block = begin; block < rows; block += blockSize) {
+         size_t blockEnd = min(rows, block + blockSize);
+         bool different = false;
+         for (size_t row = block; row != blockEnd; ++row) {
+            different |= input[row] != reference[row];
+         }
+         if (different) {
+            for (size_t row = block; row != blockEnd; ++row) {
+               if (input[row] != reference[row]) {
+                  return row;
+               }
+            }
+         }
+      }
+      return rows;
+   }
+
+   size_t findFirstDifference(Column& column, size_t begin, size_t rows) {
+      switch (column.type) {
+         case(Attribute::Type::Integer):
+         case(Attribute::Type::Date):
+         return findFirstDifference(column.inputIntegers, column.referenceIntegers, begin, rows);
+         case(Attribute::Type::BigInt):
+         return findFirstDifference(column.inputBigInts, column.referenceBigInts, begin, rows);
+         case(Attribute::Type::Varchar):
+         case(Attribute::Type::Char):
+         return findFirstDifference(column.inputStrings, column.referenceStrings, begin, rows);
+         case(Attribute::Type::Decimal):
+         if (column.tolerance.kind == Tolerance::Kind::Exact) {
+            return findFirstDifference(column.inputDecimals, column.referenceDecimals, begin, rows);
+         }
+         for (size_t row = begin; row < rows; ++row) {
+            if (!column.tolerance.allows(column.inputDecimals[row], column.referenceDecimals[row])) {
+               return row;
+            }
+         }
+         return rows;
+      }
+      return rows;
+   }
+
+   // Reports the first difference in row major order, or all of them if mismatches are collected
+   void compareBatch(util::StructuredFile& inputFile, size_t rows) {
+      if (mismatches) {
+         collectBatch(inputFile, rows);
+         return;
+      }
+      size_t firstRow = rows;
+      Column* firstColumn = nullptr;
+      for (auto& column : columns) {
+         size_t row = findFirstDifference(column, 0, firstRow);
+         if (row < firstRow) {
+            firstRow = row;
+            firstColumn = &column;
+         }
+      }
+      if (firstColumn) {
+         string reference = referenceText(*firstColumn, firstRow);
+         string input(firstColumn->inputFields[firstRow]);
+         Schema::throwMismatch(inputFile.getFilename(), lines[firstRow], string("expected ") + reference + string(" got ") + input, firstColumn - columns.data());
+      }
+   }
+
+   void collectBatch(util::StructuredFile& inputFile, size_t rows) {
+      differences.clear();
+      for (size_t field = 0; field != columns.size(); ++field) {
+         for (size_t row = findFirstDifference(columns[field], 0, rows); row < rows; row = findFirstDifference(columns[field], row + 1, rows)) {
+            differences.emplace_back(row, field);
+         }
+      }
+      sort(differences.begin(), differences.end());
+      for (auto& difference : differences) {
+         Column& column = columns[difference.second];
+         string message;
+         if (mismatches->needsMessage()) {
+            message = inputFile.getFilename() + ":" + to_string(lines[difference.first]) + "\t" + "expected " + referenceText(column, difference.first) + " got " + string(column.inputFields[difference.first]);
+         }
+         mismatches->add(difference.second, lines[difference.first], message);
+      }
+   }
+
+   // Throws the error of the call, or adds it to the mismatches if they are collected
+   template <typename Function>
+   void check(Function function) {
+      try {
+         function();
+      } catch (SchemaException& e) {
+         if (!mismatches) {
+            throw;
+         }
+         mismatches->add(e);
+      }
+   }
+
+   // Compares the batch, the time since the previous batch was spent on tokenizing and decoding its records
+   void flushBatch(util::StructuredFile& inputFile, size_t rows) {
+      if (statistics) {
+         statistics->add("tokenize", batchBegin, util::ResourceSample::now());
+         statistics->addRows(rows + identicalRows);
+      }
+      identicalRows = 0;
+      {
+         util::Statistics::Timer timer(statistics, "compare");
+         compareBatch(inputFile, rows);
+      }
+      if (statistics) {
+         batchBegin = util::ResourceSample::now();
+      }
+   }
+
+public:
+   ComparisonPlan(Schema& schema, double epsilon, bool trimStrings, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) : schema(schema), epsilon(epsilon), trimStrings(trimStrings), lines(batchSize), statistics(statistics), mismatches(mismatches), compiled(nullptr), referenceTextFile(nullptr), referenceRecords(batchSize), identicalRows(0) {
+      for (auto& attribute : schema.attributes) {
+         Column column;
+         column.type = attribute.type;
+         column.null = attribute.null;
+         column.length = attribute.length;
+         column.precision = attribute.precision;
+         switch (attribute.type) {
+            case(Attribute::Type::Integer):
+            case(Attribute::Type::Date):
+            column.inputIntegers.resize(batchSize);
+            column.referenceIntegers.resize(batchSize);
+            break;
+            case(Attribute::Type::Decimal):
+            column.inputDecimals.resize(batchSize);
+            column.referenceDecimals.resize(batchSize);
+            column.tolerance = Schema::toleranceOf(attribute, epsilon);
+            break;
+            case(Attribute::Type::BigInt):
+            column.inputBigInts.resize(batchSize);
+            column.referenceBigInts.resize(batchSize);
+            break;
+            case(Attribute::Type::Varchar):
+            case(Attribute::Type::Char):
+            column.inputStrings.resize(batchSize);
+            column.referenceStrings.resize(batchSize);
+            break;
+         }
+         column.inputFields.resize(batchSize);
+         column.referenceFields.resize(batchSize);
+         columns.push_back(move(column));
+      }
+   }
+
+   // With a compiled reference, the text of the reference is only read for records that could not be compiled and
+   // for messages
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, const CompiledReference* compiledReference = nullptr) {
+      using Status = util::StructuredFile::Status;
+      compiled = compiledReference;
+      referenceTextFile = &referenceFile;
+      uint64_t referenceHeader = referenceFile.ignoreFirstLine;
+      size_t rows = 0;
+      if (statistics) {
+         batchBegin = util::ResourceSample::now();
+      }
+      for (uint64_t record = 0; ; ++record) {
+         // Reading more of a streamed file invalidates the fields of the batch
+         if (rows != 0 && !(inputFile.isRecordBuffered() && (compiled || referenceFile.isRecordBuffered()))) {
+            flushBatch(inputFile, rows);
+            rows = 0;
+         }
+         bool inputFinished = inputFile.nextRecord() == Status::EndOfFile;
+         bool referenceFinished = compiled ? record == compiled->getNumberOfRecords() : referenceFile.nextRecord() == Status::EndOfFile;
+         if (inputFinished || referenceFinished) {
+            flushBatch(inputFile, rows);
+            if (inputFinished && referenceFinished) {
+               return;
+            }
+            if (inputFinished) {
+               check([&]() { schema.throwError(inputFile, "too few results"); });
+               return;
+            }
+            // trim empty lines from end of input file
+            while (inputFile.getRecord().empty()) {
+               if (inputFile.nextRecord() == Status::EndOfFile) {
+                  return;
+               }
+            }
+            check([&]() { schema.throwError(inputFile, "too many results"); });
+            return;
+         }
+         if (!compiled && inputFile.getRecord() == referenceFile.getRecord() && hasAllFields(inputFile)) {
+            ++identicalRows;
+            continue;
+         }
+         lines[rows] = inputFile.getLineNumber();
+         if (compiled ? decodeCompiledRecord(rows, inputFile, record) : decodeRecord(rows, inputFile, referenceFile)) {
+            if (++rows == batchSize) {
+               flushBatch(inputFile, rows);
+               rows = 0;
+            }
+         } else {
+            flushBatch(inputFile, rows);
+            rows = 0;
+            util::StructuredFile inputRecord = inputFile.sliceRecord();
+            util::StructuredFile referenceRecord = compiled ? util::StructuredFile(referenceFile, compiled->recordBegin(record), compiled->recordEnd(record), referenceHeader + record) : referenceFile.sliceRecord();
+            if (compiled) {
+               referenceRecord.nextRecord();
+            }
+            {
+               util::Statistics::Timer timer(statistics, "compare");
+               check([&]() { schema.compareRecord(inputRecord, referenceRecord, epsilon, trimStrings); });
+            }
+            if (statistics) {
+               statistics->addRows(1);
+               batchBegin = util::ResourceSample::now();
+            }
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+inline void Schema::compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, double epsilon, bool trimStrings, util::Statistics* statistics, MismatchCollector* mismatches) {
+   ComparisonPlan(*this, epsilon, trimStrings, statistics, mismatches).compare(inputFile, referenceFile);
+}
+//---------------------------------------------------------------------------
+// Compares input and reference as multisets of normalized rows. Results that do not fit into the memory budget are
+// hash partitioned into fanOut temporary files per side first, every partition is then compared on its own and
+// partitioned further if it still does not fit.
+class UnorderedComparison {
+private:
+   static constexpr unsigned partitionBits = 4;
+   static constexpr size_t fanOut = size_t(1) << partitionBits;
+
+   typedef vector<unique_ptr<util::TemporaryFile>> Partitions;
+
+   struct Entry {
+      int64_t count = 0;
+      uint64_t inputLine = 0;
+      uint64_t referenceLine = 0;
+   };
+
+   struct Difference {
+      string row;
+      Entry entry;
+   };
+
+   Schema& schema;
+   bool trimStrings;
+   size_t memoryBudget;
+   util::Statistics* statistics;
+   unordered_map<string, Entry> rows;
+   // The surplus input row with the smallest line, otherwise the missing reference row with the smallest line
+   Difference surplus;
+   Difference missing;
+
+   void add(const string& row, uint64_t line, bool input) {
+      Entry& entry = rows[row];
+      if (input) {
+         ++entry.count;
+         if (entry.inputLine == 0) {
+            entry.inputLine = line;
+         }
+      } else {
+         --entry.count;
+         if (entry.referenceLine == 0) {
+            entry.referenceLine = line;
+         }
+      }
+   }
+
+   void collectDifferences() {
+      for (auto& row : rows) {
+         Entry& entry = row.second;
+         if (entry.count > 0 && (surplus.entry.count == 0 || entry.inputLine < surplus.entry.inputLine)) {
+            surplus = Difference{row.first, entry};
+         } else if (entry.count < 0 && (missing.entry.count == 0 || entry.referenceLine < missing.entry.referenceLine)) {
+            missing = Difference{row.first, entry};
+         }
+      }
+      rows.clear();
+   }
+
+   // Calls consume(row, line) for every normalized record, empty records at the end of the input are ignored
+   template <typename Consumer>
+   void scan(util::StructuredFile& file, bool input, Consumer consume) {
+      util::Statistics::Timer timer(statistics, "scan");
+      string row;
+      uint64_t records = 0;
+      uint64_t emptyRecords = 0;
+      uint64_t firstEmptyLine = 0;
+      while (file.nextRecord() == util::StructuredFile::Status::Success) {
+         ++records;
+         if (input && file.getRecord().empty()) {
+            if (emptyRecords++ == 0) {
+               firstEmptyLine = file.getLineNumber();
+            }
+            continue;
+         }
+         for (; emptyRecords != 0; --emptyRecords) {
+            schema.normalizeEmptyRecord(file.getFilename(), firstEmptyLine, trimStrings, row);
+            consume(row, firstEmptyLine++);
+         }
+         schema.normalizeRecord(file, trimStrings, row);
+         consume(row, file.getLineNumber());
+      }
+      if (statistics && !input) {
+         statistics->addRows(records);
+      }
+   }
+
+   static void write(util::TemporaryFile& partition, const string& row, uint64_t line) {
+      uint32_t length = row.size();
+      partition.write(&length, sizeof(length));
+      partition.write(&line, sizeof(line));
+      partition.write(row.data(), length);
+   }
+
+   // Calls consume(row, line) for every row of the partition
+   template <typename Consumer>
+   static void read(util::TemporaryFile& partition, Consumer consume) {
+      partition.rewind();
+      string row;
+      uint32_t length;
+      uint64_t line;
+      while (partition.read(&length, sizeof(length))) {
+         row.resize(length);
+         if (!partition.read(&line, sizeof(line)) || !partition.read(&row[0], length)) {
+            throw util::FileError("temporary file ends within a row");
+         }
+         consume(row, line);
+      }
+   }
+
+   static Partitions createPartitions() {
+      Partitions partitions;
+      for (size_t partition = 0; partition != fanOut; ++partition) {
+         partitions.emplace_back(new util::TemporaryFile());
+      }
+      return partitions;
+   }
+
+   // Every level of partitioning uses other bits of the hash of the row
+   static size_t partitionOf(const string& row, unsigned level) {
+      return (hash<string>()(row) >> (partitionBits*level)) % fanOut;
+   }
+
+   // Compares the pairs of partitions one after the other. Pairs that exceed the memory budget are partitioned again
+   // on the next level, unless that did not make them any smaller, e.g. because they hold copies of the same rows,
+   // which share an entry of the hash table anyway.
+   void comparePartitions(Partitions& inputPartitions, Partitions& referencePartitions, unsigned level, uint64_t parentSize) {
+      for (size_t partition = 0; partition != fanOut; ++partition) {
+         util::TemporaryFile& input = *inputPartitions[partition];
+         util::TemporaryFile& reference = *referencePartitions[partition];
+         uint64_t size = input.size() + reference.size();
+         if (2*size > memoryBudget && size < parentSize && partitionBits*(level + 2) <= 64) {
+            Partitions inputSubpartitions = createPartitions();
+            Partitions referenceSubpartitions = createPartitions();
+            read(input, [&](const string& row, uint64_t line) { write(*inputSubpartitions[partitionOf(row, level + 1)], row, line); });
+            read(reference, [&](const string& row, uint64_t line) { write(*referenceSubpartitions[partitionOf(row, level + 1)], row, line); });
+            inputPartitions[partition] = nullptr;
+            referencePartitions[partition] = nullptr;
+            comparePartitions(inputSubpartitions, referenceSubpartitions, level + 1, size);
+            continue;
+         }
+         read(input, [&](const string& row, uint64_t line) { add(row, line, true); });
+         read(reference, [&](const string& row, uint64_t line) { add(row, line, false); });
+         collectDifferences();
+         // Closes the files of the pair early, which bounds the open files by the depth of the partitioning
+         inputPartitions[partition] = nullptr;
+         referencePartitions[partition] = nullptr;
+      }
+   }
+
+public:
+   UnorderedComparison(Schema& schema, bool trimStrings, size_t memoryBudget, util::Statistics* statistics = nullptr) : schema(schema), trimStrings(trimStrings), memoryBudget(memoryBudget), statistics(statistics) {}
+
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      auto add = [this](bool input) {
+         return [this, input](const string& row, uint64_t line) { this->add(row, line, input); };
+      };
+      // Normalized rows take about as much space as the text, the hash table roughly doubles that. The size of a
+      // streamed input is unknown, it is assumed to be as large as the reference.
+      size_t referenceSize = referenceFile.isStreamed() ? memoryBudget : referenceFile.dataEnd() - referenceFile.dataBegin();
+      size_t size = referenceSize + (inputFile.isStreamed() ? referenceSize : inputFile.dataEnd() - inputFile.dataBegin());
+      if (2*size <= memoryBudget) {
+         scan(inputFile, true, add(true));
+         scan(referenceFile, false, add(false));
+         util::Statistics::Timer timer(statistics, "compare");
+         collectDifferences();
+      } else {
+         Partitions inputPartitions = createPartitions();
+         Partitions referencePartitions = createPartitions();
+         scan(inputFile, true, [&](const string& row, uint64_t line) { write(*inputPartitions[partitionOf(row, 0)], row, line); });
+         scan(referenceFile, false, [&](const string& row, uint64_t line) { write(*referencePartitions[partitionOf(row, 0)], row, line); });
+         util::Statistics::Timer timer(statistics, "compare");
+         comparePartitions(inputPartitions, referencePartitions, 0, numeric_limits<uint64_t>::max());
+      }
+      if (surplus.entry.count > 0) {
+         Schema::throwError(inputFile.getFilename(), surplus.entry.inputLine, "row occurs " + to_string(surplus.entry.count) + " more time(s) than in reference: " + surplus.row);
+      }
+      if (missing.entry.count < 0) {
+         Schema::throwError(referenceFile.getFilename(), missing.entry.referenceLine, "row occurs " + to_string(-missing.entry.count) + " more time(s) than in input: " + missing.row);
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// Compares results that are only ordered by the sort key attributes of the schema, records with equal sort keys may
+// appear in any order. The reference is cut into runs of records with equal sort keys, the same number of input
+// records is read, and both runs are sorted by their normalized records and compared pairwise. Decimals are sorted by
+// value, so that values within the tolerance of each other pair up unless several decimal columns of a run order the
+// records differently. The records of a run are copied into a reused arena, so memory is bounded by the largest run
+// and streamed files work as well.
+class TieGroupComparison {
+private:
+   struct Record {
+      size_t offset;
+      size_t length;
+      uint64_t line;
+      // The normalized fields other than decimals, the values of the decimals and the whole normalized record
+      string exact;
+      vector<double> decimals;
+      string order;
+
+      bool operator<(const Record& other) const {
+         return tie(exact, decimals, order) < tie(other.exact, other.decimals, other.order);
+      }
+   };
+
+   struct Run {
+      string arena;
+      vector<Record> records;
+
+      void append(util::StructuredFile& file) {
+         string_view text = file.getRecord();
+         records.push_back(Record{arena.size(), text.size(), file.getLineNumber(), string(), vector<double>(), string()});
+         arena.append(text);
+      }
+
+      // Keeps only the last record, which starts the next run
+      void keepLast() {
+         Record last = records.back();
+         arena.erase(0, last.offset);
+         last.offset = 0;
+         records.assign(1, last);
+      }
+
+      // A file that contains only the record and is positioned at it
+      util::StructuredFile slice(util::StructuredFile& file, const Record& record) {
+         util::StructuredFile slice(file, arena.data() + record.offset, arena.data() + record.offset + record.length, record.line - 1);
+         slice.nextRecord();
+         return slice;
+      }
+   };
+
+   Schema& schema;
+   double epsilon;
+   bool trimStrings;
+   util::Statistics* statistics;
+   MismatchCollector* mismatches;
+   vector<int> sortKeys;
+   Run inputRun;
+   Run referenceRun;
+
+   // Normalized sort key values of the record, invalid values are kept as they are and reported by the comparison
+   string sortKey(util::StructuredFile& file, Run& run, const Record& record) {
+      util::StructuredFile slice = run.slice(file, record);
+      string key;
+      string_view value;
+      int field = 0;
+      for (int sortKey : sortKeys) {
+         for (; field <= sortKey; ++field) {
+            if (slice.nextField(value) == util::StructuredFile::Status::EndOfRecord) {
+               return key;
+            }
+         }
+         key += '\t';
+         try {
+            schema.normalize(sortKey, value, trimStrings, key);
+         } catch (SchemaException& e) {
+            key.append(value);
+         }
+      }
+      return key;
+   }
+
+   // Splits the normalized record into the fields that are compared exactly and the values of the decimals, nulls are
+   // the smallest values
+   void splitOrder(Record& record) {
+      record.exact.clear();
+      record.decimals.clear();
+      string_view row = record.order;
+      for (int field = 0; field != schema.getNumberOfAttributes(); ++field) {
+         string_view value = row.substr(0, row.find('\t'));
+         row.remove_prefix(min(row.size(), value.size() + 1));
+         if (schema.attributes[field].type == Attribute::Type::Decimal) {
+            double decimal = -numeric_limits<double>::infinity();
+            from_chars(value.data(), value.data() + value.size(), decimal);
+            record.decimals.push_back(decimal);
+         } else {
+            record.exact.append(value);
+            record.exact += '\t';
+         }
+      }
+   }
+
+   // Orders the first records of the run (see Record), or by their raw text if they cannot be normalized
+   void sort(util::StructuredFile& file, Run& run, size_t records) {
+      if (records == 1) {
+         return;
+      }
+      for (auto record = run.records.begin(); record != run.records.begin() + records; ++record) {
+         util::StructuredFile slice = run.slice(file, *record);
+         try {
+            schema.normalizeRecord(slice, trimStrings, record->order);
+            splitOrder(*record);
+         } catch (SchemaException& e) {
+            record->exact.clear();
+            record->decimals.clear();
+            record->order.assign(run.arena, record->offset, record->length);
+         }
+      }
+      stable_sort(run.records.begin(), run.records.begin() + records);
+   }
+
+   // Throws the error of the call, or adds it to the mismatches if they are collected
+   template <typename Function>
+   void check(Function function) {
+      try {
+         function();
+      } catch (SchemaException& e) {
+         if (!mismatches) {
+            throw;
+         }
+         mismatches->add(e);
+      }
+   }
+
+   // Returns false if the input ended before the run
+   bool compareRun(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, size_t records) {
+      using Status = util::StructuredFile::Status;
+      inputRun.arena.clear();
+      inputRun.records.clear();
+      for (size_t record = 0; record != records; ++record) {
+         if (inputFile.nextRecord() == Status::EndOfFile) {
+            check([&]() { schema.throwError(inputFile, "too few results"); });
+            return false;
+         }
+         inputRun.append(inputFile);
+      }
+      sort(inputFile, inputRun, records);
+      sort(referenceFile, referenceRun, records);
+      for (size_t record = 0; record != records; ++record) {
+         util::StructuredFile input = inputRun.slice(inputFile, inputRun.records[record]);
+         util::StructuredFile reference = referenceRun.slice(referenceFile, referenceRun.records[record]);
+         check([&]() { schema.compareRecord(input, reference, epsilon, trimStrings); });
+      }
+      if (statistics) {
+         statistics->addRows(records);
+      }
+      return true;
+   }
+
+public:
+   TieGroupComparison(Schema& schema, double epsilon, bool trimStrings, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) : schema(schema), epsilon(epsilon), trimStrings(trimStrings), statistics(statistics), mismatches(mismatches), sortKeys(schema.getSortKeys()) {}
+
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      using Status = util::StructuredFile::Status;
+      util::Statistics::Timer timer(statistics, "compare");
+      bool referenceFinished = referenceFile.nextRecord() == Status::EndOfFile;
+      if (!referenceFinished) {
+         referenceRun.append(referenceFile);
+      }
+      while (!referenceFinished) {
+         string key = sortKey(referenceFile, referenceRun, referenceRun.records.front());
+         bool runFinished = false;
+         while (!runFinished) {
+            referenceFinished = referenceFile.nextRecord() == Status::EndOfFile;
+            if (referenceFinished) {
+               break;
+            }
+            referenceRun.append(referenceFile);
+            runFinished = sortKey(referenceFile, referenceRun, referenceRun.records.back()) != key;
+         }
+         if (!compareRun(inputFile, referenceFile, referenceRun.records.size() - runFinished)) {
+            return;
+         }
+         referenceRun.keepLast();
+      }
+      // trim empty lines from end of input file
+      while (inputFile.nextRecord() == Status::Success) {
+         if (!inputFile.getRecord().empty()) {
+            check([&]() { schema.throwError(inputFile, "too many results"); });
+            return;
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// Compares the input against digests of the normalized records of the reference in chunks of recordsPerChunk records.
+// The digests are stored in a sidecar file next to the reference (reference.digest) and rebuilt when the reference,
+// the schema or string trimming changed. Only chunks whose digests differ are compared field by field, so the
+// reference is mostly not read at all.
+class DigestComparison {
+private:
+   static constexpr uint64_t recordsPerChunk = 1 << 16;
+   static constexpr char magic[8] = {'v', 's', 'r', 'd', 'i', 'g', '0', '2'};
+
+   struct Header {
+      char magic[8];
+      uint64_t referenceSize;
+      int64_t referenceModified;
+      uint64_t fingerprintLow;
+      uint64_t fingerprintHigh;
+      uint64_t recordsPerChunk;
+      uint64_t numberOfChunks;
+   };
+
+   struct Chunk {
+      // Of the first record, relative to the first record of the reference
+      uint64_t offset;
+      uint64_t digestLow;
+      uint64_t digestHigh;
+   };
+
+   Schema& schema;
+   double epsilon;
+   bool trimStrings;
+   util::Statistics* statistics;
+   MismatchCollector* mismatches;
+   Header header;
+   vector<Chunk> chunks;
+
+   Header expectedHeader(util::StructuredFile& referenceFile) {
+      Header expected{};
+      memcpy(expected.magic, magic, sizeof(magic));
+      struct stat statistics;
+      if (stat(referenceFile.getFilename().c_str(), &statistics) == 0) {
+         expected.referenceSize = statistics.st_size;
+         expected.referenceModified = int64_t(statistics.st_mtim.tv_sec)*1000000000 + statistics.st_mtim.tv_nsec;
+      }
+      util::Digest digest = schema.fingerprint();
+      digest.add(trimStrings ? "trim" : "");
+      digest.add(referenceFile.ignoreFirstLine ? "header" : "");
+      expected.fingerprintLow = digest.low;
+      expected.fingerprintHigh = digest.high;
+      expected.recordsPerChunk = recordsPerChunk;
+      return expected;
+   }
+
+   // Calls consume(begin, end, records, digest) for every chunk of records in [begin, end) of file until it returns false, the
+   // digest is absent if a record of the chunk cannot be normalized
+   template <typename Consumer>
+   void digestChunks(util::StructuredFile& file, const char* begin, const char* end, Consumer consume) {
+      util::Statistics::Timer timer(statistics, "digest");
+      util::StructuredFile records(file, begin, end, 0);
+      string row;
+      const char* chunkBegin = begin;
+      uint64_t chunkRecords = 0;
+      util::Digest digest;
+      bool valid = true;
+      while (records.nextRecord() == util::StructuredFile::Status::Success) {
+         if (chunkRecords == recordsPerChunk) {
+            const char* chunkEnd = records.getRecord().data();
+            if (!consume(chunkBegin, chunkEnd, chunkRecords, valid ? &digest : nullptr)) {
+               return;
+            }
+            chunkBegin = chunkEnd;
+            chunkRecords = 0;
+            digest = util::Digest();
+            valid = true;
+         }
+         ++chunkRecords;
+         if (valid) {
+            try {
+               schema.normalizeRecord(records, trimStrings, row);
+               digest.add(row);
+            } catch (SchemaException& e) {
+               valid = false;
+            }
+         }
+      }
+      if (chunkRecords) {
+         consume(chunkBegin, end, chunkRecords, valid ? &digest : nullptr);
+      }
+   }
+
+   bool load(string filename, const Header& expected) {
+      FILE* file = fopen(filename.c_str(), "r");
+      if (!file) {
+         return false;
+      }
+      bool loaded = fread(&header, sizeof(header), 1, file) == 1 && memcmp(&header, &expected, offsetof(Header, numberOfChunks)) == 0;
+      if (loaded) {
+         chunks.resize(header.numberOfChunks);
+         loaded = fread(chunks.data(), sizeof(Chunk), chunks.size(), file) == chunks.size();
+      }
+      fclose(file);
+      return loaded;
+   }
+
+   // Returns false if the reference has invalid records and thus no digests
+   bool build(util::StructuredFile& referenceFile, const Header& expected) {
+      header = expected;
+      chunks.clear();
+      const char* referenceBegin = referenceFile.dataBegin();
+      bool valid = true;
+      digestChunks(referenceFile, referenceBegin, referenceFile.dataEnd(), [&](const char* begin, const char*, uint64_t, util::Digest* digest) {
+         valid = digest != nullptr;
+         if (valid) {
+            chunks.push_back(Chunk{uint64_t(begin - referenceBegin), digest->low, digest->high});
+         }
+         return valid;
+      });
+      header.numberOfChunks = chunks.size();
+      return valid;
+   }
+
+   // The sidecar is only a cache, it is not an error if it cannot be written
+   void store(string filename) {
+      string temporaryFilename;
+      FILE* file = util::createSiblingFile(filename, temporaryFilename);
+      if (!file) {
+         return;
+      }
+      bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(chunks.data(), sizeof(Chunk), chunks.size(), file) == chunks.size();
+      written &= fclose(file) == 0;
+      if (!written || rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+         unlink(temporaryFilename.c_str());
+      }
+   }
+
+public:
+   DigestComparison(Schema& schema, double epsilon, bool trimStrings, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) : schema(schema), epsilon(epsilon), trimStrings(trimStrings), statistics(statistics), mismatches(mismatches) {}
+
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      if (inputFile.isStreamed() || referenceFile.isStreamed()) {
+         schema.compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+         return;
+      }
+      string sidecar = referenceFile.getFilename() + ".digest";
+      Header expected = expectedHeader(referenceFile);
+      if (!load(sidecar, expected)) {
+         if (!build(referenceFile, expected)) {
+            schema.compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+            return;
+         }
+         store(sidecar);
+      }
+      const char* referenceBegin = referenceFile.dataBegin();
+      const char* referenceEnd = referenceFile.dataEnd();
+      uint64_t inputHeader = inputFile.ignoreFirstLine;
+      uint64_t referenceHeader = referenceFile.ignoreFirstLine;
+      const char* inputEnd = inputFile.dataEnd();
+      uint64_t chunk = 0;
+      digestChunks(inputFile, inputFile.dataBegin(), inputEnd, [&](const char* begin, const char* end, uint64_t records, util::Digest* digest) {
+         bool equal = digest && chunk < chunks.size() && digest->low == chunks[chunk].digestLow && digest->high == chunks[chunk].digestHigh;
+         // Chunks before the last one of either file have the same number of records on both sides, otherwise the rest
+         // of both files is compared to find missing or additional results
+         bool last = end == inputEnd || chunk + 1 >= chunks.size();
+         if (equal && (!last || (end == inputEnd && chunk + 1 == chunks.size()))) {
+            if (statistics) {
+               statistics->addRows(records);
+            }
+            ++chunk;
+            return true;
+         }
+         uint64_t precedingRecords = chunk * recordsPerChunk;
+         util::StructuredFile inputChunk(inputFile, begin, last ? inputEnd : end, inputHeader + precedingRecords);
+         util::StructuredFile referenceChunk(referenceFile, referenceBegin + (chunk < chunks.size() ? chunks[chunk].offset : referenceEnd - referenceBegin), last ? referenceEnd : referenceBegin + chunks[chunk + 1].offset, referenceHeader + precedingRecords);
+         schema.compare(inputChunk, referenceChunk, epsilon, trimStrings, statistics, mismatches);
+         ++chunk;
+         return !last;
+      });
+      if (chunk == 0) {
+         // The input has no records
+         schema.compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// Reads input and reference on threads of their own while the calling thread compares. Each reader copies batches of
+// recordsPerBatch records into buffers that it hands to the comparer through a lock-free ring buffer, and gets them
+// back through another one once they were compared. Reading, decompressing and page faults of both files thus overlap
+// with the comparison, streamed files included. Batch i of the input is compared to batch i of the reference.
+class PipelinedComparison {
+private:
+   static constexpr uint64_t recordsPerBatch = 1 << 14;
+   static constexpr size_t batchesPerFile = 4;
+
+   struct Batch {
+      // The records, each one followed by the record delimiter
+      string data;
+      uint64_t records;
+      // Lines before the first record of the batch
+      uint64_t precedingLines;
+      // The file ended within the batch or could not be read further
+      bool last;
+      exception_ptr exception;
+   };
+
+   // The batches of one file and the queues between its reader and the comparer
+   struct Reader {
+      vector<Batch> batches;
+      util::RingBuffer<Batch*, batchesPerFile> free;
+      util::RingBuffer<Batch*, batchesPerFile> full;
+
+      Reader() : batches(batchesPerFile) {
+         for (auto& batch : batches) {
+            free.tryPush(&batch);
+         }
+      }
+   };
+
+   Schema& schema;
+   double epsilon;
+   bool trimStrings;
+   util::Statistics* statistics;
+   MismatchCollector* mismatches;
+
+   // Runs on the thread of the file until its end or until the comparer stops
+   static void read(util::StructuredFile& file, Reader& reader, const atomic<bool>& stopping) {
+      uint64_t lines = file.ignoreFirstLine;
+      while (true) {
+         Batch* batch;
+         if (!reader.free.pop(batch, &stopping)) {
+            return;
+         }
+         batch->data.clear();
+         batch->records = 0;
+         batch->precedingLines = lines;
+         batch->last = false;
+         batch->exception = nullptr;
+         try {
+            while (batch->records != recordsPerBatch) {
+               if (file.nextRecord() == util::StructuredFile::Status::EndOfFile) {
+                  batch->last = true;
+                  break;
+               }
+               string_view record = file.getRecord();
+               batch->data.append(record.data(), record.size());
+               batch->data += file.recordDelimiter;
+               ++batch->records;
+            }
+         } catch (...) {
+            batch->exception = current_exception();
+            batch->last = true;
+         }
+         lines += batch->records;
+         bool last = batch->last;
+         if (!reader.full.push(batch, &stopping) || last) {
+            return;
+         }
+      }
+   }
+
+   static Batch* next(Reader& reader) {
+      Batch* batch;
+      reader.full.pop(batch);
+      if (batch->exception) {
+         rethrow_exception(batch->exception);
+      }
+      return batch;
+   }
+
+   // The records of the batch as a file, an empty file if there is no batch
+   static util::StructuredFile slice(util::StructuredFile& prototype, Batch* batch, uint64_t precedingLines) {
+      if (!batch) {
+         return util::StructuredFile(prototype, nullptr, nullptr, precedingLines);
+      }
+      return util::StructuredFile(prototype, batch->data.data(), batch->data.data() + batch->data.size(), batch->precedingLines);
+   }
+
+   void compareBatches(Reader& input, Reader& reference, util::StructuredFile& inputPrototype, util::StructuredFile& referencePrototype) {
+      ComparisonPlan plan(schema, epsilon, trimStrings, statistics, mismatches);
+      Batch* referenceBatch = nullptr;
+      bool referenceEnded = false;
+      uint64_t referenceLines = 0;
+      while (true) {
+         Batch* inputBatch = next(input);
+         if (referenceBatch) {
+            // Input batches after the last one of the reference may only contain empty lines
+            referenceEnded = referenceBatch->last;
+            referenceLines = referenceBatch->precedingLines + referenceBatch->records;
+            reference.free.push(referenceBatch);
+            referenceBatch = nullptr;
+         }
+         if (!referenceEnded) {
+            referenceBatch = next(reference);
+         }
+         util::StructuredFile inputSlice = slice(inputPrototype, inputBatch, 0);
+         util::StructuredFile referenceSlice = slice(referencePrototype, referenceBatch, referenceLines);
+         uint64_t errors = mismatches ? mismatches->getCount() : 0;
+         plan.compare(inputSlice, referenceSlice);
+         bool inputEnded = inputBatch->last;
+         input.free.push(inputBatch);
+         // Missing or additional results end the comparison, as they do for a whole file
+         bool lastReference = referenceEnded || (referenceBatch && referenceBatch->last);
+         if (inputEnded || (lastReference && mismatches && mismatches->getCount() != errors)) {
+            return;
+         }
+      }
+   }
+
+public:
+   PipelinedComparison(Schema& schema, double epsilon, bool trimStrings, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) : schema(schema), epsilon(epsilon), trimStrings(trimStrings), statistics(statistics), mismatches(mismatches) {}
+
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      // Slices take the name and delimiters of the files, which are only touched by their readers once they run
+      util::StructuredFile inputPrototype(inputFile, nullptr, nullptr, 0);
+      util::StructuredFile referencePrototype(referenceFile, nullptr, nullptr, 0);
+      Reader input;
+      Reader reference;
+      atomic<bool> stopping(false);
+      thread inputThread([&]() { read(inputFile, input, stopping); });
+      thread referenceThread([&]() { read(referenceFile, reference, stopping); });
+      exception_ptr exception;
+      try {
+         compareBatches(input, reference, inputPrototype, referencePrototype);
+      } catch (...) {
+         exception = current_exception();
+      }
+      stopping = true;
+      inputThread.join();
+      referenceThread.join();
+      if (exception) {
+         rethrow_exception(exception);
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// A quick verdict for large mapped results. A full pass splits both files into chunks of recordsPerChunk records,
+// counts their records and computes a digest of the raw bytes of every chunk. Chunks that are byte for byte equal to
+// the reference need no comparison, of the others only a sample is compared field by field. The sample is drawn at
+// random, or one chunk per stratum of equal size, from a seeded generator so that runs are reproducible. The differing
+// chunks that were not drawn are counted as unverified. Differing numbers of records are always found, as the chunks
+// from the end of the shorter file on are compared.
+class SampledComparison {
+private:
+   static constexpr uint64_t recordsPerChunk = 1 << 14;
+
+   struct Chunk {
+      const char* begin;
+      const char* end;
+      uint64_t records;
+      util::Digest digest;
+   };
+
+   Schema& schema;
+   double epsilon;
+   bool trimStrings;
+   // Fraction of the differing chunks in the sample
+   double fraction;
+   bool stratified;
+   uint64_t seed;
+   util::Statistics* statistics;
+   MismatchCollector* mismatches;
+   uint64_t records;
+   uint64_t sampledRecords;
+   uint64_t identicalRecords;
+   // Chunks whose checksums differ but that were not drawn, and their records
+   uint64_t unverifiedChunks;
+   uint64_t unverifiedRecords;
+   bool complete;
+
+   vector<Chunk> splitIntoChunks(util::StructuredFile& file) {
+      vector<Chunk> chunks;
+      const char* end = file.dataEnd();
+      for (const char* position = file.dataBegin(); position != end;) {
+         Chunk chunk{position, position, 0, util::Digest()};
+         for (; chunk.records != recordsPerChunk && chunk.end != end; ++chunk.records) {
+            chunk.end = file.skipRecord(chunk.end);
+         }
+         chunk.digest.add(string_view(chunk.begin, chunk.end - chunk.begin));
+         position = chunk.end;
+         chunks.push_back(chunk);
+      }
+      return chunks;
+   }
+
+   static uint64_t countRecords(const vector<Chunk>& chunks) {
+      uint64_t count = 0;
+      for (auto& chunk : chunks) {
+         count += chunk.records;
+      }
+      return count;
+   }
+
+   // Sorted numbers of the chunks in [0, numberOfChunks) that are compared
+   vector<size_t> drawSample(size_t numberOfChunks) {
+      size_t sampleSize = min<size_t>(numberOfChunks, ceil(fraction*numberOfChunks));
+      vector<size_t> sample;
+      if (sampleSize == 0) {
+         return sample;
+      }
+      mt19937_64 generator(seed);
+      if (stratified) {
+         for (size_t stratum = 0; stratum != sampleSize; ++stratum) {
+            size_t begin = stratum*numberOfChunks/sampleSize;
+            size_t end = (stratum + 1)*numberOfChunks/sampleSize;
+            sample.push_back(begin + generator()%(end - begin));
+         }
+      } else {
+         vector<size_t> chunks(numberOfChunks);
+         for (size_t chunk = 0; chunk != numberOfChunks; ++chunk) {
+            chunks[chunk] = chunk;
+         }
+         // The first sampleSize entries of a partial Fisher-Yates shuffle
+         for (size_t chunk = 0; chunk != sampleSize; ++chunk) {
+            swap(chunks[chunk], chunks[chunk + generator()%(numberOfChunks - chunk)]);
+         }
+         sample.assign(chunks.begin(), chunks.begin() + sampleSize);
+         sort(sample.begin(), sample.end());
+      }
+      return sample;
+   }
+
+   void compareSlices(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, const char* inputBegin, const char* inputEnd, const char* referenceBegin, const char* referenceEnd, uint64_t precedingRecords) {
+      util::StructuredFile inputChunk(inputFile, inputBegin, inputEnd, uint64_t(inputFile.ignoreFirstLine) + precedingRecords);
+      util::StructuredFile referenceChunk(referenceFile, referenceBegin, referenceEnd, uint64_t(referenceFile.ignoreFirstLine) + precedingRecords);
+      schema.compare(inputChunk, referenceChunk, epsilon, trimStrings, statistics, mismatches);
+   }
+
+public:
+   SampledComparison(Schema& schema, double epsilon, bool trimStrings, double fraction, bool stratified, uint64_t seed, util::Statistics* statistics = nullptr, MismatchCollector* mismatches = nullptr) : schema(schema), epsilon(epsilon), trimStrings(trimStrings), fraction(fraction), stratified(stratified), seed(seed), statistics(statistics), mismatches(mismatches), records(0), sampledRecords(0), identicalRecords(0), unverifiedChunks(0), unverifiedRecords(0), complete(false) {}
+
+   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile) {
+      if (inputFile.isStreamed() || referenceFile.isStreamed()) {
+         // Streamed files are read once, so they are compared in full
+         schema.compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+         complete = true;
+         return;
+      }
+      vector<Chunk> inputChunks;
+      vector<Chunk> referenceChunks;
+      {
+         util::Statistics::Timer timer(statistics, "checksum");
+         inputChunks = splitIntoChunks(inputFile);
+         referenceChunks = splitIntoChunks(referenceFile);
+      }
+      records = countRecords(referenceChunks);
+      // All chunks before the last one of the shorter file have the same number of records on both sides
+      size_t pairedChunks = min(inputChunks.size(), referenceChunks.size());
+      bool sameRecords = countRecords(inputChunks) == records;
+      size_t sampledChunks = sameRecords ? pairedChunks : max<size_t>(pairedChunks, 1) - 1;
+      // Only chunks whose checksums differ can contain mismatches, so the sample is drawn from them
+      vector<size_t> differing;
+      for (size_t chunk = 0; chunk != sampledChunks; ++chunk) {
+         Chunk& input = inputChunks[chunk];
+         Chunk& reference = referenceChunks[chunk];
+         if (input.digest == reference.digest && input.end - input.begin == reference.end - reference.begin) {
+            identicalRecords += reference.records;
+            if (statistics) {
+               statistics->addRows(reference.records);
+            }
+         } else {
+            differing.push_back(chunk);
+         }
+      }
+      vector<size_t> sample = drawSample(differing.size());
+      auto sampled = sample.begin();
+      for (size_t index = 0; index != differing.size(); ++index) {
+         size_t chunk = differing[index];
+         Chunk& input = inputChunks[chunk];
+         Chunk& reference = referenceChunks[chunk];
+         if (sampled != sample.end() && *sampled == index) {
+            ++sampled;
+            compareSlices(inputFile, referenceFile, input.begin, input.end, reference.begin, reference.end, chunk*recordsPerChunk);
+            sampledRecords += reference.records;
+         } else {
+            ++unverifiedChunks;
+            unverifiedRecords += reference.records;
+         }
+      }
+      if (!sameRecords) {
+         // Finds the first missing or additional record, and compares the records before it
+         const char* inputBegin = sampledChunks < inputChunks.size() ? inputChunks[sampledChunks].begin : inputFile.dataEnd();
+         const char* referenceBegin = sampledChunks < referenceChunks.size() ? referenceChunks[sampledChunks].begin : referenceFile.dataEnd();
+         compareSlices(inputFile, referenceFile, inputBegin, inputFile.dataEnd(), referenceBegin, referenceFile.dataEnd(), sampledChunks*recordsPerChunk);
+         sampledRecords += records - min<uint64_t>(records, sampledChunks*recordsPerChunk);
+      }
+   }
+
+   // True if the files were compared in full instead, e.g. because they were streamed
+   bool isComplete() const {
+      return complete;
+   }
+
+   // Records of the reference
+   uint64_t getRecords() const {
+      return records;
+   }
+
+   // Records that were compared field by field, or found to be byte for byte equal to the reference
+   uint64_t getVerifiedRecords() const {
+      return sampledRecords + identicalRecords;
+   }
+
+   uint64_t getIdenticalRecords() const {
+      return identicalRecords;
+   }
+
+   // Differing chunks that were not compared, mismatches in them went unnoticed
+   uint64_t getUnverifiedChunks() const {
+      return unverifiedChunks;
+   }
+
+   uint64_t getUnverifiedRecords() const {
+      return unverifiedRecords;
+   }
+};
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,249 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_COMPRESSEDSTREAM_H_
+#define UTIL_COMPRESSEDSTREAM_H_
+//---------------------------------------------------------------------------
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#include "FileError.hpp"
+#include "InputStream.hpp"
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Decompresses one format, reading the compressed bytes from a file
+class Decoder {
+protected:
+   DescriptorStream file;
+   std::vector<char> input;
+   size_t inputBegin;
+   size_t inputEnd;
+
+   // Makes sure there are unconsumed compressed bytes, returns false at the end of the file
+   bool fillInput() {
+      if (inputBegin == inputEnd) {
+         inputBegin = 0;
+         inputEnd = file.read(input.data(), input.size());
+      }
+      return inputBegin != inputEnd;
+   }
+
+   void fail() {
+      throw FileError("failed to decompress " + file.filename);
+   }
+
+public:
+   Decoder(std::string filename) : file(filename), input(1 << 20), inputBegin(0), inputEnd(0) {}
+
+   virtual ~Decoder() {}
+
+   // Decompresses at most size bytes, returns 0 at the end of the data
+   virtual size_t decode(char* output, size_t size) = 0;
+};
+//---------------------------------------------------------------------------
+class GzipDecoder : public Decoder {
+private:
+   z_stream stream;
+   bool endOfMember;
+
+public:
+   GzipDecoder(std::string filename) : Decoder(filename), endOfMember(false) {
+      memset(&stream, 0, sizeof(stream));
+      // 16 + MAX_WBITS selects the gzip format
+      if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+         fail();
+      }
+   }
+
+   ~GzipDecoder() {
+      inflateEnd(&stream);
+   }
+
+   size_t decode(char* output, size_t size) override {
+      stream.next_out = reinterpret_cast<Bytef*>(output);
+      stream.avail_out = size;
+      while (stream.avail_out != 0) {
+         bool hasInput = fillInput();
+         // Concatenated gzip files consist of several members
+         if (endOfMember) {
+            if (!hasInput) {
+               break;
+            }
+            inflateReset(&stream);
+            endOfMember = false;
+         }
+         stream.next_in = reinterpret_cast<Bytef*>(input.data() + inputBegin);
+         stream.avail_in = inputEnd - inputBegin;
+         uInt available = stream.avail_out;
+         int result = inflate(&stream, Z_NO_FLUSH);
+         inputBegin = inputEnd - stream.avail_in;
+         if (result == Z_STREAM_END) {
+            endOfMember = true;
+         } else if ((result != Z_OK && result != Z_BUF_ERROR) || (!hasInput && stream.avail_out == available)) {
+            // Corrupt or truncated
+            fail();
+         }
+      }
+      return size - stream.avail_out;
+   }
+};
+//---------------------------------------------------------------------------
+#ifdef USE_ZSTD
+class ZstdDecoder : public Decoder {
+private:
+   ZSTD_DStream* stream;
+   size_t pending;
+
+public:
+   ZstdDecoder(std::string filename) : Decoder(filename), stream(ZSTD_createDStream()), pending(0) {
+      if (!stream || ZSTD_isError(ZSTD_initDStream(stream))) {
+         fail();
+      }
+   }
+
+   ~ZstdDecoder() {
+      ZSTD_freeDStream(stream);
+   }
+
+   size_t decode(char* output, size_t size) override {
+      ZSTD_outBuffer out{output, size, 0};
+      while (out.pos != out.size) {
+         bool hasInput = fillInput();
+         // pending is zero once a frame is completely decoded and flushed
+         if (!hasInput && pending == 0) {
+            break;
+         }
+         ZSTD_inBuffer in{input.data(), inputEnd, inputBegin};
+         size_t available = out.size - out.pos;
+         pending = ZSTD_decompressStream(stream, &out, &in);
+         inputBegin = in.pos;
+         if (ZSTD_isError(pending) || (!hasInput && out.size - out.pos == available)) {
+            // Corrupt or truncated
+            fail();
+         }
+      }
+      return out.pos;
+   }
+};
+#endif
+//---------------------------------------------------------------------------
+// Decompresses .gz and .zst files on a separate thread, so that decompression overlaps with the consumer
+class CompressedStream : public InputStream {
+private:
+   static constexpr size_t blockSize = 4 << 20;
+   static constexpr size_t maximumBlocks = 4;
+
+   std::unique_ptr<Decoder> decoder;
+   std::thread worker;
+   std::mutex mutex;
+   std::condition_variable changed;
+   std::deque<std::vector<char>> blocks;
+   bool finished;
+   bool stopping;
+   std::vector<char> current;
+   size_t offset;
+   // A failure of the worker, rethrown by the consumer
+   std::exception_ptr error;
+
+   void decompress() {
+      while (true) {
+         std::vector<char> block(blockSize);
+         try {
+            block.resize(decoder->decode(block.data(), block.size()));
+         } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+            finished = true;
+            changed.notify_all();
+            return;
+         }
+         std::unique_lock<std::mutex> lock(mutex);
+         if (block.empty()) {
+            finished = true;
+            changed.notify_all();
+            return;
+         }
+         changed.wait(lock, [this]() { return stopping || blocks.size() < maximumBlocks; });
+         if (stopping) {
+            return;
+         }
+         blocks.push_back(move(block));
+         changed.notify_all();
+      }
+   }
+
+public:
+   static bool isCompressed(const std::string& filename) {
+      return hasSuffix(filename, ".gz") || hasSuffix(filename, ".zst");
+   }
+
+   static bool hasSuffix(const std::string& filename, const std::string& suffix) {
+      return filename.size() >= suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+   }
+
+   CompressedStream(std::string filename) : finished(false), stopping(false), offset(0) {
+      if (hasSuffix(filename, ".gz")) {
+         decoder.reset(new GzipDecoder(filename));
+      } else {
+#ifdef USE_ZSTD
+         decoder.reset(new ZstdDecoder(filename));
+#else
+         throw FileError(filename + ": built without zstd support");
+#endif
+      }
+      worker = std::thread([this]() { decompress(); });
+   }
+
+   ~CompressedStream() {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      changed.notify_all();
+      worker.join();
+   }
+
+   size_t read(char* buffer, size_t size) override {
+      size_t bytes = 0;
+      while (bytes != size) {
+         if (offset == current.size()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Only wait if nothing was read yet
+            if (blocks.empty() && bytes != 0) {
+               break;
+            }
+            changed.wait(lock, [this]() { return finished || !blocks.empty(); });
+            if (blocks.empty()) {
+               if (error) {
+                  std::rethrow_exception(error);
+               }
+               break;
+            }
+            current = move(blocks.front());
+            blocks.pop_front();
+            offset = 0;
+            changed.notify_all();
+         }
+         size_t chunk = std::min(size - bytes, current.size() - offset);
+         memcpy(buffer + bytes, current.data() + offset, chunk);
+         bytes += chunk;
+         offset += chunk;
+      }
+      return bytes;
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,58 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_DIGEST_H_
+#define UTIL_DIGEST_H_
+//---------------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// 128 bit digest of a sequence of strings that detects accidental differences, it is not cryptographic. The result
+// depends on the order of the strings and on where one ends and the next begins.
+class Digest {
+private:
+   static uint64_t mix(uint64_t a, uint64_t b) {
+      __uint128_t product = static_cast<__uint128_t>(a) * b;
+      return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+   }
+
+   void addWord(uint64_t word) {
+      low = mix(low ^ word, 0x9e3779b97f4a7c15ull);
+      high = mix(high + word, 0xc2b2ae3d27d4eb4full) ^ low;
+   }
+
+public:
+   uint64_t low;
+   uint64_t high;
+
+   Digest() : low(0x243f6a8885a308d3ull), high(0x13198a2e03707344ull) {}
+
+   void add(std::string_view value) {
+      const char* position = value.data();
+      const char* end = position + value.size();
+      for (; end - position >= 8; position += 8) {
+         uint64_t word;
+         memcpy(&word, position, 8);
+         addWord(word);
+      }
+      uint64_t word = 0;
+      memcpy(&word, position, end - position);
+      addWord(word);
+      addWord(value.size());
+   }
+
+   bool operator==(const Digest& other) const {
+      return low == other.low && high == other.high;
+   }
+
+   bool operator!=(const Digest& other) const {
+      return !(*this == other);
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
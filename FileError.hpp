@@ -0,0 +1,20 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_FILEERROR_H_
+#define UTIL_FILEERROR_H_
+//---------------------------------------------------------------------------
+#include <stdexcept>
+#include <string>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// A file that cannot be opened, mapped, read, decompressed or written, the message names the file
+class FileError : public std::runtime_error {
+public:
+   FileError(std::string message) : std::runtime_error(message) {}
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,222 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_INPUTSTREAM_H_
+#define UTIL_INPUTSTREAM_H_
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "FileError.hpp"
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Sequential source of bytes for inputs that cannot be mapped, e.g. pipes
+class InputStream {
+public:
+   virtual ~InputStream() {}
+
+   // Reads at most size bytes, returns 0 at the end of the stream
+   virtual size_t read(char* buffer, size_t size) = 0;
+};
+//---------------------------------------------------------------------------
+class DescriptorStream : public InputStream {
+private:
+   int descriptor;
+   bool owned;
+
+public:
+   std::string filename;
+
+   // Reads from an already open descriptor such as stdin
+   DescriptorStream(int descriptor, std::string filename) : descriptor(descriptor), owned(false), filename(filename) {}
+
+   DescriptorStream(std::string filename) : owned(true), filename(filename) {
+      descriptor = open(filename.c_str(), O_RDONLY);
+      if (descriptor == -1) {
+         throw FileError("failed to open " + filename);
+      }
+   }
+
+   ~DescriptorStream() {
+      if (owned) {
+         close(descriptor);
+      }
+   }
+
+   int getDescriptor() {
+      return descriptor;
+   }
+
+   size_t read(char* buffer, size_t size) override {
+      while (true) {
+         ssize_t bytes = ::read(descriptor, buffer, size);
+         if (bytes >= 0) {
+            return bytes;
+         }
+         if (errno != EINTR) {
+            throw FileError("failed to read " + filename);
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// A regular file that is still being written. At the end of the written part, reading waits for inotify events of the
+// file until the writer appends more or closes it. The stream ends after the file was closed by a writer, when no
+// process has it open for writing, or when it did not change for idleMilliseconds.
+class FollowStream : public InputStream {
+private:
+   DescriptorStream file;
+   int notify;
+   int idleMilliseconds;
+   bool closed;
+
+   // Whether a process may have the file open for writing. Read leases are only granted while none has, so one is
+   // taken and given up at once. Without leases, e.g. for files of other users, any process may.
+   bool mayBeWritten() {
+      int descriptor = file.getDescriptor();
+      // A writer that opens the file in between breaks the lease with a signal that is ignored by default
+      if (fcntl(descriptor, F_SETSIG, SIGURG) == -1 || fcntl(descriptor, F_SETLEASE, F_RDLCK) == -1) {
+         return true;
+      }
+      fcntl(descriptor, F_SETLEASE, F_UNLCK);
+      return false;
+   }
+
+   // Waits for the next changes of the file, returns false if there were none
+   bool wait() {
+      pollfd events{notify, POLLIN, 0};
+      int ready = poll(&events, 1, idleMilliseconds);
+      if (ready == 0) {
+         return false;
+      }
+      if (ready < 0) {
+         if (errno == EINTR) {
+            return true;
+         }
+         throw FileError("failed to watch " + file.filename);
+      }
+      alignas(inotify_event) char buffer[4096];
+      ssize_t bytes = ::read(notify, buffer, sizeof(buffer));
+      for (ssize_t offset = 0; offset < bytes;) {
+         const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+         closed |= (event->mask & IN_CLOSE_WRITE) != 0;
+         offset += sizeof(inotify_event) + event->len;
+      }
+      return true;
+   }
+
+public:
+   FollowStream(std::string filename, int idleMilliseconds) : file(filename), idleMilliseconds(idleMilliseconds), closed(false) {
+      // Watching before the first read, so that no change after it is missed
+      notify = inotify_init1(IN_CLOEXEC);
+      if (notify == -1 || inotify_add_watch(notify, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+         if (notify != -1) {
+            close(notify);
+         }
+         throw FileError("failed to watch " + filename);
+      }
+   }
+
+   ~FollowStream() {
+      close(notify);
+   }
+
+   // Waits until filename was created, e.g. by a writer that has not started yet. Returns false if its directory did
+   // not change for idleMilliseconds before.
+   static bool waitForCreation(const std::string& filename, int idleMilliseconds) {
+      size_t slash = filename.find_last_of('/');
+      std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+      int notify = inotify_init1(IN_CLOEXEC);
+      if (notify == -1 || inotify_add_watch(notify, directory.c_str(), IN_CREATE | IN_MOVED_TO) == -1) {
+         if (notify != -1) {
+            close(notify);
+         }
+         throw FileError("failed to watch " + directory);
+      }
+      // Checked after watching, so that a creation in between is not missed
+      bool created;
+      while (!(created = access(filename.c_str(), F_OK) == 0)) {
+         pollfd events{notify, POLLIN, 0};
+         int ready = poll(&events, 1, idleMilliseconds);
+         if (ready == 0) {
+            break;
+         }
+         if (ready < 0 && errno != EINTR) {
+            close(notify);
+            throw FileError("failed to watch " + directory);
+         }
+         if (ready > 0) {
+            alignas(inotify_event) char buffer[4096];
+            if (::read(notify, buffer, sizeof(buffer)) < 0 && errno != EINTR) {
+               close(notify);
+               throw FileError("failed to watch " + directory);
+            }
+         }
+      }
+      close(notify);
+      return created;
+   }
+
+   size_t read(char* buffer, size_t size) override {
+      while (true) {
+         size_t bytes = file.read(buffer, size);
+         if (bytes != 0 || closed) {
+            return bytes;
+         }
+         // After the last change, or once there is no writer, the bytes written before are read once more
+         if (!mayBeWritten() || !wait()) {
+            closed = true;
+         }
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// The records of a producer, each followed by a newline. The producer sets record to the next record without the
+// newline and returns false after the last one, the record only has to stay valid until the next call.
+class RecordStream : public InputStream {
+private:
+   std::function<bool(std::string_view& record)> producer;
+   // The part of the current record that was not read yet
+   std::string_view pending;
+   bool pendingDelimiter;
+   bool finished;
+
+public:
+   RecordStream(std::function<bool(std::string_view& record)> producer) : producer(producer), pendingDelimiter(false), finished(false) {}
+
+   size_t read(char* buffer, size_t size) override {
+      size_t bytes = 0;
+      while (bytes != size) {
+         if (!pending.empty()) {
+            size_t chunk = std::min(size - bytes, pending.size());
+            memcpy(buffer + bytes, pending.data(), chunk);
+            bytes += chunk;
+            pending.remove_prefix(chunk);
+         } else if (pendingDelimiter) {
+            buffer[bytes++] = '\n';
+            pendingDelimiter = false;
+         } else if (finished || !producer(pending)) {
+            finished = true;
+            break;
+         } else {
+            pendingDelimiter = true;
+         }
+      }
+      return bytes;
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,207 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_JSON_H_
+#define UTIL_JSON_H_
+//---------------------------------------------------------------------------
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Content of a JSON string literal for value, without the quotes
+inline std::string escapeJson(std::string_view value) {
+   std::string escaped;
+   for (char character : value) {
+      switch (character) {
+         case '"': escaped += "\\\""; break;
+         case '\\': escaped += "\\\\"; break;
+         case '\n': escaped += "\\n"; break;
+         case '\r': escaped += "\\r"; break;
+         case '\t': escaped += "\\t"; break;
+         default:
+            if (static_cast<unsigned char>(character) < 0x20) {
+               char code[7];
+               snprintf(code, sizeof(code), "\\u%04x", character);
+               escaped += code;
+            } else {
+               escaped += character;
+            }
+      }
+   }
+   return escaped;
+}
+//---------------------------------------------------------------------------
+// Reads the JSON string literal that starts at position and moves position behind it, returns false if it is
+// malformed. Escaped code points are stored as UTF-8, surrogate pairs are not combined.
+inline bool readJsonString(std::string_view text, size_t& position, std::string& value) {
+   if (position == text.size() || text[position] != '"') {
+      return false;
+   }
+   value.clear();
+   for (++position; position != text.size(); ++position) {
+      char character = text[position];
+      if (character == '"') {
+         ++position;
+         return true;
+      }
+      if (character != '\\') {
+         value += character;
+         continue;
+      }
+      if (++position == text.size()) {
+         return false;
+      }
+      switch (text[position]) {
+         case '"': value += '"'; break;
+         case '\\': value += '\\'; break;
+         case '/': value += '/'; break;
+         case 'b': value += '\b'; break;
+         case 'f': value += '\f'; break;
+         case 'n': value += '\n'; break;
+         case 'r': value += '\r'; break;
+         case 't': value += '\t'; break;
+         case 'u': {
+            if (text.size() - position < 5) {
+               return false;
+            }
+            unsigned code = 0;
+            for (size_t digit = 1; digit != 5; ++digit) {
+               char hex = text[position + digit];
+               unsigned nibble = hex >= '0' && hex <= '9' ? hex - '0' : hex >= 'a' && hex <= 'f' ? hex - 'a' + 10 : hex >= 'A' && hex <= 'F' ? hex - 'A' + 10 : 16;
+               if (nibble == 16) {
+                  return false;
+               }
+               code = code * 16 + nibble;
+            }
+            position += 4;
+            if (code < 0x80) {
+               value += char(code);
+            } else if (code < 0x800) {
+               value += char(0xc0 | (code >> 6));
+               value += char(0x80 | (code & 0x3f));
+            } else {
+               value += char(0xe0 | (code >> 12));
+               value += char(0x80 | ((code >> 6) & 0x3f));
+               value += char(0x80 | (code & 0x3f));
+            }
+            break;
+         }
+         default:
+            return false;
+      }
+   }
+   return false;
+}
+//---------------------------------------------------------------------------
+// A parsed JSON value. Numbers keep their text, so that 64 bit integers are not rounded through a double.
+class JsonValue {
+public:
+   enum class Type {
+      Null, Boolean, Number, String, Array, Object
+   };
+   Type type = Type::Null;
+   bool boolean = false;
+   // The text of a number or the value of a string
+   std::string text;
+   std::vector<JsonValue> elements;
+   std::vector<std::pair<std::string, JsonValue>> members;
+
+   // The member of an object, nullptr if there is none or the value is no object
+   const JsonValue* find(std::string_view key) const {
+      for (auto& member : members) {
+         if (member.first == key) {
+            return &member.second;
+         }
+      }
+      return nullptr;
+   }
+};
+//---------------------------------------------------------------------------
+// Reads the JSON value that starts at position, after optional whitespace, and moves position behind it. Returns false
+// if it is malformed or nested deeper than maximumDepth.
+inline bool readJson(std::string_view text, size_t& position, JsonValue& value, unsigned maximumDepth = 64) {
+   auto skipSpaces = [&]() {
+      while (position != text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) {
+         ++position;
+      }
+   };
+   auto skipLiteral = [&](std::string_view literal) {
+      if (text.substr(position, literal.size()) != literal) {
+         return false;
+      }
+      position += literal.size();
+      return true;
+   };
+   skipSpaces();
+   if (position == text.size() || maximumDepth == 0) {
+      return false;
+   }
+   value = JsonValue();
+   char character = text[position];
+   if (character == '"') {
+      value.type = JsonValue::Type::String;
+      return readJsonString(text, position, value.text);
+   }
+   if (character == 't' || character == 'f') {
+      value.type = JsonValue::Type::Boolean;
+      value.boolean = character == 't';
+      return skipLiteral(value.boolean ? "true" : "false");
+   }
+   if (character == 'n') {
+      return skipLiteral("null");
+   }
+   if (character == '[' || character == '{') {
+      bool object = character == '{';
+      value.type = object ? JsonValue::Type::Object : JsonValue::Type::Array;
+      ++position;
+      skipSpaces();
+      if (position != text.size() && text[position] == (object ? '}' : ']')) {
+         ++position;
+         return true;
+      }
+      while (true) {
+         std::string key;
+         if (object) {
+            skipSpaces();
+            if (!readJsonString(text, position, key)) {
+               return false;
+            }
+            skipSpaces();
+            if (!skipLiteral(":")) {
+               return false;
+            }
+         }
+         JsonValue element;
+         if (!readJson(text, position, element, maximumDepth - 1)) {
+            return false;
+         }
+         if (object) {
+            value.members.emplace_back(std::move(key), std::move(element));
+         } else {
+            value.elements.push_back(std::move(element));
+         }
+         skipSpaces();
+         if (skipLiteral(",")) {
+            continue;
+         }
+         return skipLiteral(object ? "}" : "]");
+      }
+   }
+   // A number, its syntax is checked by the conversion of the caller
+   size_t begin = position;
+   while (position != text.size() && (isdigit(static_cast<unsigned char>(text[position])) || text[position] == '-' || text[position] == '+' || text[position] == '.' || text[position] == 'e' || text[position] == 'E')) {
+      ++position;
+   }
+   value.type = JsonValue::Type::Number;
+   value.text = std::string(text.substr(begin, position - begin));
+   return position != begin;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -4,12 +4,15 @@
 #ifndef UTIL_MAPPEDFILE_H_
 #define UTIL_MAPPEDFILE_H_
 //---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
 #include <fcntl.h>
 #include <iostream>
 #include <fstream>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "FileError.hpp"
 //---------------------------------------------------------------------------
 namespace util {
 //---------------------------------------------------------------------------
@@ -31,12 +34,22 @@ public:
 
    MappedFile(std::string filename) : filename(filename) {
       descriptor = open(filename.c_str(), O_RDONLY);
+      if (descriptor == -1) {
+         throw FileError("failed to open " + filename);
+      }
       size = fileSize()/sizeof(T);
-      content = reinterpret_cast<T*>(mapFile());
+      try {
+         content = reinterpret_cast<T*>(mapFile());
+      } catch (...) {
+         close(descriptor);
+         throw;
+      }
    }
 
    ~MappedFile() {
-      munmap(content, size);
+      if (content) {
+         munmap(content, size * sizeof(T));
+      }
       close(descriptor);
    }
 
@@ -50,12 +63,18 @@ public:
       if (size == 0) return nullptr;
       char *fileContent = reinterpret_cast<char*>(mmap(NULL, size * sizeof(T), PROT_READ, MAP_FILE|MAP_SHARED, descriptor, 0));
       if (fileContent == MAP_FAILED) {
-         std::cout << "failed to open " << filename << std::endl;
-         exit(EXIT_FAILURE);
+         throw FileError("failed to open " + filename);
       }
       return fileContent;
    }
 
+   // Access pattern hint for the whole mapping, e.g. MADV_SEQUENTIAL
+   void advise(int advice) {
+      if (content) {
+         madvise(content, size * sizeof(T), advice);
+      }
+   }
+
    MappedFile::iterator begin() const {
       return content;
    }
@@ -65,6 +84,83 @@ public:
    }
 };
 //---------------------------------------------------------------------------
+// Maps a window of a file that only moves forward, so files larger than memory can be read sequentially. The next
+// window is read ahead and pages behind the window are dropped from the page cache.
+class MappedWindow {
+private:
+   int descriptor;
+   size_t pageSize;
+
+   void unmap() {
+      if (content) {
+         madvise(content, size, MADV_DONTNEED);
+         munmap(content, size);
+         content = nullptr;
+      }
+   }
+
+public:
+   std::string filename;
+   uint64_t fileSize;
+   uint64_t offset;
+   size_t size;
+   char* content;
+
+   MappedWindow(std::string filename) : pageSize(sysconf(_SC_PAGESIZE)), filename(filename), offset(0), size(0), content(nullptr) {
+      descriptor = open(filename.c_str(), O_RDONLY);
+      struct stat statistics;
+      if (descriptor == -1 || fstat(descriptor, &statistics) == -1) {
+         if (descriptor != -1) {
+            close(descriptor);
+         }
+         throw FileError("failed to open " + filename);
+      }
+      fileSize = statistics.st_size;
+   }
+
+   ~MappedWindow() {
+      unmap();
+      close(descriptor);
+   }
+
+   // Maps at most windowSize bytes from the page that contains position (an offset into the file)
+   void map(uint64_t position, size_t windowSize) {
+      uint64_t previousOffset = offset;
+      unmap();
+      offset = position - position % pageSize;
+      size = std::min<uint64_t>(windowSize, fileSize - offset);
+      if (size == 0) {
+         return;
+      }
+      content = reinterpret_cast<char*>(mmap(NULL, size, PROT_READ, MAP_FILE|MAP_SHARED, descriptor, offset));
+      if (content == MAP_FAILED) {
+         content = nullptr;
+         size = 0;
+         throw FileError("failed to open " + filename);
+      }
+      madvise(content, size, MADV_SEQUENTIAL);
+      madvise(content, size, MADV_WILLNEED);
+      if (offset + size < fileSize) {
+         posix_fadvise(descriptor, offset + size, windowSize, POSIX_FADV_WILLNEED);
+      }
+      if (previousOffset < offset) {
+         posix_fadvise(descriptor, previousOffset, offset - previousOffset, POSIX_FADV_DONTNEED);
+      }
+   }
+
+   bool coversEnd() const {
+      return offset + size == fileSize;
+   }
+
+   const char* begin() const {
+      return content;
+   }
+
+   const char* end() const {
+      return content + size;
+   }
+};
+//---------------------------------------------------------------------------
 }
 //---------------------------------------------------------------------------
 #endif
@@ -0,0 +1,246 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_NUMBERPARSER_H_
+#define UTIL_NUMBERPARSER_H_
+//---------------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+//---------------------------------------------------------------------------
+// Parsers that work directly on the bytes of a field. Surrounding whitespace is ignored, anything else that does not
+// belong to the number makes the input malformed.
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+enum class ParseStatus {
+   Success, Malformed, Overflow
+};
+//---------------------------------------------------------------------------
+inline bool isSpace(char character) {
+   return character == ' ' || (character >= '\t' && character <= '\r');
+}
+//---------------------------------------------------------------------------
+inline std::string_view trimSpaces(std::string_view input) {
+   while (!input.empty() && isSpace(input.front())) {
+      input.remove_prefix(1);
+   }
+   while (!input.empty() && isSpace(input.back())) {
+      input.remove_suffix(1);
+   }
+   return input;
+}
+//---------------------------------------------------------------------------
+inline uint64_t loadEightBytes(const char* position) {
+   uint64_t word;
+   memcpy(&word, position, sizeof(word));
+   return word;
+}
+//---------------------------------------------------------------------------
+// True if all eight bytes of the little endian word are ASCII digits
+inline bool isEightDigits(uint64_t word) {
+   return (((word & 0xF0F0F0F0F0F0F0F0ull) | (((word + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+//---------------------------------------------------------------------------
+// Value of eight ASCII digits in a little endian word (first digit in the lowest byte)
+inline uint32_t parseEightDigits(uint64_t word) {
+   word -= 0x3030303030303030ull;
+   word = (word * 10) + (word >> 8);
+   word = (((word & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) + (((word >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+   return static_cast<uint32_t>(word);
+}
+//---------------------------------------------------------------------------
+// Parses an unsigned digit sequence, eight digits at a time where possible
+inline ParseStatus parseDigits(const char* position, const char* end, uint64_t& value) {
+   if (position == end) {
+      return ParseStatus::Malformed;
+   }
+   value = 0;
+   while (end - position >= 8) {
+      uint64_t word = loadEightBytes(position);
+      if (!isEightDigits(word)) {
+         break;
+      }
+      if (__builtin_mul_overflow(value, 100000000, &value) || __builtin_add_overflow(value, parseEightDigits(word), &value)) {
+         return ParseStatus::Overflow;
+      }
+      position += 8;
+   }
+   for (; position != end; ++position) {
+      unsigned digit = static_cast<unsigned char>(*position) - '0';
+      if (digit > 9) {
+         return ParseStatus::Malformed;
+      }
+      if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, digit, &value)) {
+         return ParseStatus::Overflow;
+      }
+   }
+   return ParseStatus::Success;
+}
+//---------------------------------------------------------------------------
+template <typename T>
+ParseStatus parseInteger(std::string_view input, T& result) {
+   input = trimSpaces(input);
+   bool negative = false;
+   if (!input.empty() && (input.front() == '-' || input.front() == '+')) {
+      negative = input.front() == '-';
+      input.remove_prefix(1);
+   }
+   uint64_t magnitude;
+   ParseStatus status = parseDigits(input.data(), input.data() + input.size(), magnitude);
+   if (status != ParseStatus::Success) {
+      return status;
+   }
+   uint64_t limit = static_cast<uint64_t>(std::numeric_limits<T>::max()) + negative;
+   if (magnitude > limit) {
+      return ParseStatus::Overflow;
+   }
+   result = negative ? static_cast<T>(0 - magnitude) : static_cast<T>(magnitude);
+   return ParseStatus::Success;
+}
+//---------------------------------------------------------------------------
+inline ParseStatus parseInt32(std::string_view input, int32_t& result) {
+   return parseInteger(input, result);
+}
+//---------------------------------------------------------------------------
+inline ParseStatus parseInt64(std::string_view input, int64_t& result) {
+   return parseInteger(input, result);
+}
+//---------------------------------------------------------------------------
+// Decimals are integers scaled by 10^scale, their magnitude stays below 10^38
+typedef __int128 Decimal128;
+//---------------------------------------------------------------------------
+inline unsigned __int128 powerOfTen(unsigned exponent) {
+   unsigned __int128 power = 1;
+   for (; exponent != 0; --exponent) {
+      power *= 10;
+   }
+   return power;
+}
+//---------------------------------------------------------------------------
+// Parses [sign] digits [. digits] into a decimal with scale fraction digits in one pass. Further fraction digits are
+// rounded half away from zero, the integral or the fractional digits may be empty but not both.
+inline ParseStatus parseDecimal(std::string_view input, int scale, Decimal128& result) {
+   static const unsigned __int128 limit = powerOfTen(38);
+   // Eight more digits stay below the limit
+   static const unsigned __int128 wordLimit = powerOfTen(30);
+   input = trimSpaces(input);
+   bool negative = false;
+   if (!input.empty() && (input.front() == '-' || input.front() == '+')) {
+      negative = input.front() == '-';
+      input.remove_prefix(1);
+   }
+   const char* position = input.data();
+   const char* end = position + input.size();
+   unsigned __int128 magnitude = 0;
+   bool hasDigits = false;
+   // Checked before multiplying, as 10*magnitude wraps around 2^128 from 3.4*10^37 on
+   auto appendDigit = [&](unsigned digit) {
+      if (magnitude > (limit - 1 - digit)/10) {
+         return false;
+      }
+      magnitude = magnitude * 10 + digit;
+      return true;
+   };
+   // The integral digits, eight at a time while there is no danger of overflow
+   while (end - position >= 8 && magnitude < wordLimit) {
+      uint64_t word = loadEightBytes(position);
+      if (!isEightDigits(word)) {
+         break;
+      }
+      magnitude = magnitude * 100000000 + parseEightDigits(word);
+      position += 8;
+      hasDigits = true;
+   }
+   for (; position != end && *position != '.'; ++position) {
+      unsigned digit = static_cast<unsigned char>(*position) - '0';
+      if (digit > 9) {
+         return ParseStatus::Malformed;
+      }
+      if (!appendDigit(digit)) {
+         return ParseStatus::Overflow;
+      }
+      hasDigits = true;
+   }
+   int fractionDigits = 0;
+   bool roundUp = false;
+   if (position != end) {
+      for (++position; position != end; ++position) {
+         unsigned digit = static_cast<unsigned char>(*position) - '0';
+         if (digit > 9) {
+            return ParseStatus::Malformed;
+         }
+         hasDigits = true;
+         if (fractionDigits < scale) {
+            if (!appendDigit(digit)) {
+               return ParseStatus::Overflow;
+            }
+            ++fractionDigits;
+         } else if (fractionDigits == scale) {
+            roundUp = digit >= 5;
+            ++fractionDigits;
+         }
+      }
+   }
+   if (!hasDigits) {
+      return ParseStatus::Malformed;
+   }
+   for (; fractionDigits < scale; ++fractionDigits) {
+      if (!appendDigit(0)) {
+         return ParseStatus::Overflow;
+      }
+   }
+   magnitude += roundUp;
+   if (magnitude >= limit) {
+      return ParseStatus::Overflow;
+   }
+   result = negative ? -static_cast<Decimal128>(magnitude) : static_cast<Decimal128>(magnitude);
+   return ParseStatus::Success;
+}
+//---------------------------------------------------------------------------
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+inline int32_t daysFromCivil(int32_t year, unsigned month, unsigned day) {
+   year -= month <= 2;
+   int32_t era = (year >= 0 ? year : year - 399)/400;
+   unsigned yearOfEra = static_cast<unsigned>(year - era*400);
+   unsigned dayOfYear = (153*(month > 2 ? month - 3 : month + 9) + 2)/5 + day - 1;
+   unsigned dayOfEra = yearOfEra*365 + yearOfEra/4 - yearOfEra/100 + dayOfYear;
+   return era*146097 + static_cast<int32_t>(dayOfEra) - 719468;
+}
+//---------------------------------------------------------------------------
+// Parses YYYY-MM-DD into the number of days since 1970-01-01
+inline ParseStatus parseDate(std::string_view input, int32_t& days) {
+   static const unsigned daysInMonth[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+   input = trimSpaces(input);
+   if (input.size() != 10 || input[4] != '-' || input[7] != '-') {
+      return ParseStatus::Malformed;
+   }
+   unsigned digits[8];
+   const char* position = input.data();
+   for (unsigned digit = 0, offset = 0; offset != 10; ++offset) {
+      if (offset == 4 || offset == 7) {
+         continue;
+      }
+      digits[digit] = static_cast<unsigned char>(position[offset]) - '0';
+      if (digits[digit++] > 9) {
+         return ParseStatus::Malformed;
+      }
+   }
+   int32_t year = digits[0]*1000 + digits[1]*100 + digits[2]*10 + digits[3];
+   unsigned month = digits[4]*10 + digits[5];
+   unsigned day = digits[6]*10 + digits[7];
+   if (month < 1 || month > 12 || day < 1 || day > daysInMonth[month - 1]) {
+      return ParseStatus::Malformed;
+   }
+   bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+   if (month == 2 && day == 29 && !leapYear) {
+      return ParseStatus::Malformed;
+   }
+   days = daysFromCivil(year, month, day);
+   return ParseStatus::Success;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
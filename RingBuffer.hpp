@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_RINGBUFFER_H_
+#define UTIL_RINGBUFFER_H_
+//---------------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Lock-free queue of a fixed capacity between exactly one producer thread and one consumer thread. Waiting for space
+// or values spins and yields, so it is meant for stages that usually keep each other busy.
+template <typename T, size_t capacity>
+class RingBuffer {
+private:
+   std::array<T, capacity> slots;
+   // Both only grow, the slot of a position is position % capacity. Kept on separate cache lines because each one is
+   // written by one thread only.
+   alignas(64) std::atomic<size_t> head;
+   alignas(64) std::atomic<size_t> tail;
+
+public:
+   RingBuffer() : head(0), tail(0) {}
+
+   bool tryPush(T value) {
+      size_t position = tail.load(std::memory_order_relaxed);
+      if (position - head.load(std::memory_order_acquire) == capacity) {
+         return false;
+      }
+      slots[position % capacity] = std::move(value);
+      tail.store(position + 1, std::memory_order_release);
+      return true;
+   }
+
+   bool tryPop(T& value) {
+      size_t position = head.load(std::memory_order_relaxed);
+      if (position == tail.load(std::memory_order_acquire)) {
+         return false;
+      }
+      value = std::move(slots[position % capacity]);
+      head.store(position + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Waits for space, returns false if stopping was set in the meantime
+   bool push(T value, const std::atomic<bool>* stopping = nullptr) {
+      while (!tryPush(value)) {
+         if (stopping && *stopping) {
+            return false;
+         }
+         std::this_thread::yield();
+      }
+      return true;
+   }
+
+   // Waits for a value, returns false if stopping was set in the meantime
+   bool pop(T& value, const std::atomic<bool>* stopping = nullptr) {
+      while (!tryPop(value)) {
+         if (stopping && *stopping) {
+            return false;
+         }
+         std::this_thread::yield();
+      }
+      return true;
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
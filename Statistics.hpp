@@ -0,0 +1,129 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_STATISTICS_H_
+#define UTIL_STATISTICS_H_
+//---------------------------------------------------------------------------
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Wall clock, CPU time and page faults of the calling thread at one point in time
+struct ResourceSample {
+   double wall;
+   double cpu;
+   uint64_t minorFaults;
+   uint64_t majorFaults;
+
+   static ResourceSample now() {
+      struct rusage usage;
+      getrusage(RUSAGE_THREAD, &usage);
+      ResourceSample sample;
+      sample.wall = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+      sample.cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1e6;
+      sample.minorFaults = usage.ru_minflt;
+      sample.majorFaults = usage.ru_majflt;
+      return sample;
+   }
+};
+//---------------------------------------------------------------------------
+// Resources spent per phase of verifying one result. Phases measured on several threads (e.g. chunks) add up the
+// time of all threads.
+class Statistics {
+public:
+   struct Phase {
+      std::string name;
+      double wall = 0;
+      double cpu = 0;
+      uint64_t minorFaults = 0;
+      uint64_t majorFaults = 0;
+   };
+
+   // Measures the phase from construction to destruction, does nothing without statistics
+   class Timer {
+   private:
+      Statistics* statistics;
+      const char* name;
+      ResourceSample begin;
+
+   public:
+      Timer(Statistics* statistics, const char* name) : statistics(statistics), name(name) {
+         if (statistics) {
+            begin = ResourceSample::now();
+         }
+      }
+
+      Timer(const Timer&) = delete;
+      Timer& operator=(const Timer&) = delete;
+
+      ~Timer() {
+         stop();
+      }
+
+      // Ends the phase before the end of the scope
+      void stop() {
+         if (statistics) {
+            statistics->add(name, begin, ResourceSample::now());
+            statistics = nullptr;
+         }
+      }
+   };
+
+   // Returns function(), which is measured as the phase
+   template <typename Function>
+   static auto measure(Statistics* statistics, const char* name, Function function) {
+      Timer timer(statistics, name);
+      return function();
+   }
+
+private:
+   std::mutex mutex;
+   std::vector<Phase> phases;
+
+public:
+   uint64_t bytes = 0;
+   uint64_t rows = 0;
+
+   void add(const std::string& name, const ResourceSample& begin, const ResourceSample& end) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto phase = phases.begin();
+      while (phase != phases.end() && phase->name != name) {
+         ++phase;
+      }
+      if (phase == phases.end()) {
+         phases.emplace_back();
+         phase = phases.end() - 1;
+         phase->name = name;
+      }
+      phase->wall += end.wall - begin.wall;
+      phase->cpu += end.cpu - begin.cpu;
+      phase->minorFaults += end.minorFaults - begin.minorFaults;
+      phase->majorFaults += end.majorFaults - begin.majorFaults;
+   }
+
+   void addRows(uint64_t count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      rows += count;
+   }
+
+   // In the order in which they were first measured
+   const std::vector<Phase>& getPhases() const {
+      return phases;
+   }
+
+   // High water mark of the resident set of the whole process in KiB
+   static uint64_t peakResidentSetSize() {
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      return usage.ru_maxrss;
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -4,84 +4,308 @@
 #ifndef UTIL_STRUCTUREDFILE_H_
 #define UTIL_STRUCTUREDFILE_H_
 //---------------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
-#include <stdexcept>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
 #include <vector>
+#include "CompressedStream.hpp"
+#include "InputStream.hpp"
 #include "MappedFile.hpp"
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
 namespace util {
 //---------------------------------------------------------------------------
-class EndOfFileException : public runtime_error {
-public:
-   EndOfFileException(string message) : runtime_error(message) {}
-};
-//---------------------------------------------------------------------------
-class EndOfRecordException : public runtime_error {
-public:
-   EndOfRecordException(string message) : runtime_error(message) {}
-};
-//---------------------------------------------------------------------------
 class StructuredFile {
+public:
+   enum class Status {
+      Success, EndOfRecord, EndOfFile
+   };
+
 private:
-   MappedFile<char> file;
-   MappedFile<char>::iterator position;
+   static constexpr size_t streamBufferSize = 1 << 20;
+
+   string filename;
+   shared_ptr<MappedFile<char>> file;
+   // Streamed input is read into a buffer that keeps at least the current record
+   shared_ptr<InputStream> stream;
+   shared_ptr<vector<char>> buffer;
+   // Files larger than the window size are mapped one window at a time, the window keeps at least the current record
+   shared_ptr<MappedWindow> window;
+   uint64_t windowSize;
+   bool streamed;
+   bool streamFinished;
+   const char* begin;
+   const char* end;
+   const char* position;
+   const char* recordBegin;
+   const char* recordEnd;
    bool endOfRecord;
-   int currentRecord;
+   bool headerSkipped;
+   uint64_t precedingLines;
+   uint64_t currentRecord;
+
+   // Positions before the first record of [begin, end)
+   void start() {
+      position = begin;
+      recordBegin = position;
+      recordEnd = position;
+      endOfRecord = true;
+      headerSkipped = false;
+      precedingLines = 0;
+      currentRecord = 0;
+   }
+
+   void skipHeader() {
+      headerSkipped = true;
+      const char* delimiter = findRecordDelimiter();
+      position = delimiter ? delimiter + 1 : end;
+   }
+
+   // Moves the window forward so that it starts at the page of position and extends beyond the current end
+   bool slideWindow() {
+      uint64_t fileOffset = window->offset + (position - window->begin());
+      size_t remaining = end - position;
+      while (fileOffset % sysconf(_SC_PAGESIZE) + remaining >= windowSize) {
+         // The current record does not fit into the window
+         windowSize *= 2;
+      }
+      window->map(fileOffset, windowSize);
+      streamFinished = window->coversEnd();
+      begin = window->begin() + (fileOffset - window->offset);
+      position = begin;
+      end = window->end();
+      recordBegin = recordEnd = position;
+      return true;
+   }
+
+   // Moves the unread bytes from position to the front of the buffer and appends the next bytes of the stream.
+   // Invalidates all views into the buffer, returns false if the stream has ended.
+   bool refill() {
+      if ((!stream && !window) || streamFinished) {
+         return false;
+      }
+      if (window) {
+         return slideWindow();
+      }
+      size_t offset = position - buffer->data();
+      size_t remaining = end - position;
+      if (remaining == buffer->size()) {
+         // The current record does not fit into the buffer
+         buffer->resize(2*buffer->size());
+      }
+      memmove(buffer->data(), buffer->data() + offset, remaining);
+      size_t bytes = stream->read(buffer->data() + remaining, buffer->size() - remaining);
+      streamFinished = bytes == 0;
+      begin = buffer->data();
+      position = begin;
+      end = begin + remaining + bytes;
+      recordBegin = recordEnd = position;
+      return !streamFinished;
+   }
+
+   // The next record delimiter at or after position, or nullptr if there is none before the end of the input
+   const char* findRecordDelimiter() {
+      size_t searched = 0;
+      while (true) {
+         if (position + searched != end) {
+            const char* delimiter = reinterpret_cast<const char*>(memchr(position + searched, recordDelimiter, end - position - searched));
+            if (delimiter) {
+               return delimiter;
+            }
+         }
+         searched = end - position;
+         if (!refill()) {
+            return nullptr;
+         }
+      }
+   }
 
 public:
    bool ignoreFirstLine;
    char fieldDelimiter;
    char recordDelimiter;
 
-   StructuredFile(std::string filename) : file(filename) {
+   // Regular files are mapped, everything else (pipes, FIFOs, "-" for stdin, .gz and .zst files) is streamed.
+   // Regular files larger than a non-zero windowSize are mapped through a sliding window of that size.
+   StructuredFile(std::string filename, uint64_t windowSize = 0) : filename(filename), windowSize(windowSize), streamed(false), streamFinished(false) {
       ignoreFirstLine = true;
       fieldDelimiter = '\t';
       recordDelimiter = '\n';
-      position = file.begin();
-      endOfRecord = false;
-      currentRecord = 0;
+      struct stat statistics;
+      if (filename == "-") {
+         this->filename = "stdin";
+         stream = make_shared<DescriptorStream>(STDIN_FILENO, this->filename);
+      } else if (CompressedStream::isCompressed(filename)) {
+         stream = make_shared<CompressedStream>(filename);
+      } else if (stat(filename.c_str(), &statistics) == 0 && !S_ISREG(statistics.st_mode)) {
+         stream = make_shared<DescriptorStream>(filename);
+      }
+      if (stream) {
+         streamed = true;
+         buffer = make_shared<vector<char>>(streamBufferSize);
+         begin = end = buffer->data();
+      } else if (windowSize && stat(filename.c_str(), &statistics) == 0 && uint64_t(statistics.st_size) > windowSize) {
+         streamed = true;
+         window = make_shared<MappedWindow>(filename);
+         window->map(0, windowSize);
+         streamFinished = window->coversEnd();
+         begin = window->begin();
+         end = window->end();
+      } else {
+         file = make_shared<MappedFile<char>>(filename);
+         begin = file->begin();
+         end = file->end();
+         file->advise(MADV_SEQUENTIAL);
+      }
+      start();
+   }
+
+   // A result that is already in memory and named filename in messages. The data is neither copied nor owned, it has
+   // to outlive the file and its copies.
+   StructuredFile(std::string filename, const char* dataBegin, const char* dataEnd) : filename(filename), windowSize(0), streamed(false), streamFinished(false) {
+      ignoreFirstLine = true;
+      fieldDelimiter = '\t';
+      recordDelimiter = '\n';
+      begin = dataBegin;
+      end = dataEnd;
+      start();
+   }
+
+   // A result that is read from source, e.g. records produced by a caller of the library
+   StructuredFile(std::string filename, shared_ptr<InputStream> source) : filename(filename), stream(source), windowSize(0), streamed(true), streamFinished(false) {
+      ignoreFirstLine = true;
+      fieldDelimiter = '\t';
+      recordDelimiter = '\n';
+      buffer = make_shared<vector<char>>(streamBufferSize);
+      begin = end = buffer->data();
+      start();
+   }
+
+   // A slice [sliceBegin, sliceEnd) of the records of file that starts after precedingLines lines
+   StructuredFile(const StructuredFile& other, const char* sliceBegin, const char* sliceEnd, uint64_t precedingLines) : StructuredFile(other) {
+      stream = nullptr;
+      window = nullptr;
+      ignoreFirstLine = false;
+      begin = sliceBegin;
+      end = sliceEnd;
+      start();
+      this->precedingLines = precedingLines;
    }
 
    string getFilename() {
-      return file.filename;
+      return filename;
    }
 
-   int getLineNumber() {
-      return currentRecord + !ignoreFirstLine + 1;
+   // Streamed and windowed files are read once from the front, the data functions below only see the buffered part
+   bool isStreamed() {
+      return streamed;
    }
 
-   string getNextField() {
-      if (endOfRecord) {
-         throw EndOfRecordException("end of record");
+   // True if nextRecord() will neither move nor discard buffered data, so views of earlier records stay valid
+   bool isRecordBuffered() {
+      if (!stream && !window) {
+         return true;
+      }
+      const char* next = currentRecord == 0 ? position : recordEnd == end ? end : recordEnd + 1;
+      return streamFinished || memchr(next, recordDelimiter, end - next) != nullptr;
+   }
+
+   // Line of the current record, or of the line after the last record once the end of the file was reached
+   uint64_t getLineNumber() {
+      return precedingLines + currentRecord + headerSkipped;
+   }
+
+   // First byte of the first record, i.e. after the header if it is ignored
+   const char* dataBegin() {
+      return ignoreFirstLine ? skipRecords(begin, 1) : begin;
+   }
+
+   const char* dataEnd() {
+      return end;
+   }
+
+   // First byte after the record that contains position
+   const char* skipRecord(const char* from) {
+      if (from == end) {
+         return end;
+      }
+      const char* delimiter = reinterpret_cast<const char*>(memchr(from, recordDelimiter, end - from));
+      return delimiter ? delimiter + 1 : end;
+   }
+
+   // Beginning of the record numberOfRecords records after the one that starts at from
+   const char* skipRecords(const char* from, uint64_t numberOfRecords) {
+      for (; numberOfRecords != 0 && from != end; --numberOfRecords) {
+         from = skipRecord(from);
       }
-      stringstream field;
-      for (; position != file.end(); ++position) {
-         char character = *position;
+      return from;
+   }
+
+   // Number of record delimiters in [from, to)
+   uint64_t countRecords(const char* from, const char* to) {
+      return count(from, to, recordDelimiter);
+   }
+
+   // Moves to the next record, skipping unread fields of the current one
+   Status nextRecord() {
+      if (currentRecord == 0) {
          if (ignoreFirstLine) {
-            ignoreFirstLine = character != recordDelimiter;
-            continue;
-         }
-         if (character == fieldDelimiter) {
-            break;
-         } else if (character == recordDelimiter) {
-            endOfRecord = true;
-            break;
+            skipHeader();
          }
-         field << character;
+      } else {
+         position = recordEnd == end ? end : recordEnd + 1;
       }
-      if (position == file.end()) {
-         throw EndOfFileException("end of file");
+      ++currentRecord;
+      if (position == end && !refill()) {
+         recordBegin = end;
+         recordEnd = end;
+         endOfRecord = true;
+         return Status::EndOfFile;
       }
-      ++position;
-      return field.str();
+      // The last record does not need a trailing delimiter
+      const char* delimiter = findRecordDelimiter();
+      recordBegin = position;
+      recordEnd = delimiter ? delimiter : end;
+      endOfRecord = false;
+      return Status::Success;
    }
 
-   void getNextRecord() {
-      endOfRecord = false;
-      ++currentRecord;
+   // The field points into the mapping and stays valid as long as the file, for streamed files see isRecordBuffered
+   Status nextField(string_view& field) {
+      if (endOfRecord) {
+         return Status::EndOfRecord;
+      }
+      const char* delimiter = reinterpret_cast<const char*>(memchr(position, fieldDelimiter, recordEnd - position));
+      if (delimiter) {
+         field = string_view(position, delimiter - position);
+         position = delimiter + 1;
+      } else {
+         field = string_view(position, recordEnd - position);
+         position = recordEnd;
+         endOfRecord = true;
+      }
+      return Status::Success;
+   }
+
+   bool hasMoreFields() {
+      return !endOfRecord;
+   }
+
+   // A file that contains only the current record and is positioned at it
+   StructuredFile sliceRecord() {
+      StructuredFile record(*this, recordBegin, recordEnd == end ? end : recordEnd + 1, getLineNumber() - 1);
+      record.nextRecord();
+      return record;
+   }
+
+   // Raw bytes of the current record without the record delimiter
+   string_view getRecord() {
+      return string_view(recordBegin, recordEnd - recordBegin);
    }
 };
 //---------------------------------------------------------------------------
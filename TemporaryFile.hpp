@@ -0,0 +1,99 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_TEMPORARYFILE_H_
+#define UTIL_TEMPORARYFILE_H_
+//---------------------------------------------------------------------------
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "FileError.hpp"
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+// Anonymous file in $TMPDIR (or /tmp) that is removed when it is closed
+class TemporaryFile {
+private:
+   FILE* file;
+   uint64_t bytes;
+
+public:
+   TemporaryFile() : bytes(0) {
+      const char* directory = getenv("TMPDIR");
+      std::string path = std::string(directory ? directory : "/tmp") + "/verify-XXXXXX";
+      int descriptor = mkstemp(&path[0]);
+      if (descriptor == -1 || (file = fdopen(descriptor, "w+")) == nullptr) {
+         if (descriptor != -1) {
+            close(descriptor);
+            unlink(path.c_str());
+         }
+         throw FileError("failed to create temporary file " + path);
+      }
+      unlink(path.c_str());
+   }
+
+   TemporaryFile(const TemporaryFile&) = delete;
+   TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+   ~TemporaryFile() {
+      fclose(file);
+   }
+
+   void write(const void* data, size_t size) {
+      if (fwrite(data, 1, size, file) != size) {
+         throw FileError("failed to write temporary file");
+      }
+      bytes += size;
+   }
+
+   // Returns false at the end of the file, throws if the file ends within the data or cannot be read
+   bool read(void* data, size_t size) {
+      size_t read = fread(data, 1, size, file);
+      if (read == size) {
+         return true;
+      }
+      if (read != 0 || ferror(file)) {
+         throw FileError("failed to read temporary file");
+      }
+      return false;
+   }
+
+   // Bytes written
+   uint64_t size() const {
+      return bytes;
+   }
+
+   // Switches from writing to reading from the start
+   void rewind() {
+      fflush(file);
+      ::rewind(file);
+   }
+};
+//---------------------------------------------------------------------------
+// Creates a file with a unique hidden name in the directory of filename and opens it for writing, so that it can be
+// renamed to filename once it is complete. Concurrent writers of the same file thus never write into each other's
+// files. Returns nullptr if the file cannot be created.
+inline FILE* createSiblingFile(const std::string& filename, std::string& siblingFilename) {
+   size_t slash = filename.find_last_of('/');
+   size_t name = slash == std::string::npos ? 0 : slash + 1;
+   siblingFilename = filename.substr(0, name) + "." + filename.substr(name) + ".XXXXXX";
+   int descriptor = mkstemp(&siblingFilename[0]);
+   if (descriptor == -1) {
+      return nullptr;
+   }
+   // mkstemp creates files that only the owner can read
+   FILE* file = fchmod(descriptor, 0644) == 0 ? fdopen(descriptor, "w") : nullptr;
+   if (!file) {
+      close(descriptor);
+      unlink(siblingFilename.c_str());
+   }
+   return file;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
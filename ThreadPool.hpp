@@ -0,0 +1,71 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef UTIL_THREADPOOL_H_
+#define UTIL_THREADPOOL_H_
+//---------------------------------------------------------------------------
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace util {
+//---------------------------------------------------------------------------
+class ThreadPool {
+private:
+   std::vector<std::thread> workers;
+   std::deque<std::function<void()>> tasks;
+   std::mutex mutex;
+   std::condition_variable available;
+   bool stopping;
+
+   void work() {
+      while (true) {
+         std::function<void()> task;
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+               return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+         }
+         task();
+      }
+   }
+
+public:
+   ThreadPool(unsigned numberOfThreads) : stopping(false) {
+      for (unsigned thread = 0; thread != numberOfThreads; ++thread) {
+         workers.emplace_back([this]() { work(); });
+      }
+   }
+
+   // Runs all scheduled tasks to completion before joining the workers
+   ~ThreadPool() {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      available.notify_all();
+      for (auto& worker : workers) {
+         worker.join();
+      }
+   }
+
+   // Tasks are started in scheduling order
+   void schedule(std::function<void()> task) {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         tasks.push_back(std::move(task));
+      }
+      available.notify_one();
+   }
+};
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,111 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#include "Verification.hpp"
+#include "Comparison.hpp"
+//---------------------------------------------------------------------------
+namespace verify {
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+Result failure(Error::Kind kind, const string& message) {
+   Result result;
+   result.errors.push_back(Error{kind, message});
+   return result;
+}
+//---------------------------------------------------------------------------
+// Same choice of comparison as the command line tool, without digests and compiled references which need files
+Result compare(Schema& schema, util::StructuredFile& inputFile, util::StructuredFile& referenceFile, const Options& options) {
+   inputFile.ignoreFirstLine = options.ignoreFirstLine;
+   // The first mismatch is collected as well when the comparison stops at it
+   MismatchCollector collector(max(options.maximumErrors, 1u), schema.getNumberOfAttributes());
+   MismatchCollector* mismatches = options.maximumErrors && !options.unordered ? &collector : nullptr;
+   Result result;
+   if (!Tolerance::isValidRelative(options.epsilon)) {
+      return failure(Error::Kind::Options, "epsilon is neither 0 nor between 0.0001 and 100 percent");
+   }
+   if (options.unordered && (options.epsilon != 0.0 || schema.hasTolerances())) {
+      return failure(Error::Kind::Options, "unordered comparisons are exact and cannot apply an epsilon or the tolerances of the schema");
+   }
+   if ((options.unordered && (options.chunks > 1 || options.pipelined)) || (options.chunks > 1 && options.pipelined)) {
+      return failure(Error::Kind::Options, "unordered, chunked and pipelined comparisons exclude each other");
+   }
+   try {
+      if (options.unordered) {
+         UnorderedComparison(schema, options.trimStrings, options.memoryBudget).compare(inputFile, referenceFile);
+      } else if (!schema.getSortKeys().empty()) {
+         TieGroupComparison(schema, options.epsilon, options.trimStrings, nullptr, mismatches).compare(inputFile, referenceFile);
+      } else if (options.chunks > 1) {
+         schema.compareInChunks(inputFile, referenceFile, options.epsilon, options.trimStrings, options.chunks, max(thread::hardware_concurrency(), 1u), nullptr, mismatches);
+      } else if (options.pipelined) {
+         PipelinedComparison(schema, options.epsilon, options.trimStrings, nullptr, mismatches).compare(inputFile, referenceFile);
+      } else {
+         schema.compare(inputFile, referenceFile, options.epsilon, options.trimStrings, nullptr, mismatches);
+      }
+   } catch (SchemaException& e) {
+      collector.add(e);
+   } catch (util::FileError& e) {
+      result.errors.push_back(Error{Error::Kind::File, e.what()});
+   }
+   for (auto& mismatch : collector.getMismatches()) {
+      result.errors.push_back(Error{Error::Kind::Mismatch, mismatch.message, mismatch.line, mismatch.field});
+   }
+   result.numberOfMismatches = collector.getCount();
+   result.mismatchesPerColumn = collector.getFieldCounts();
+   return result;
+}
+//---------------------------------------------------------------------------
+// Returns false and sets result if the schema is malformed
+bool parseSchema(std::string_view text, unique_ptr<Schema>& schema, Result& result) {
+   try {
+      schema = make_unique<Schema>(text.data(), text.data() + text.size());
+      return true;
+   } catch (exception& e) {
+      // Includes malformed lengths and precisions
+      result = failure(Error::Kind::Schema, e.what());
+      return false;
+   }
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+Result verifyBuffers(std::string_view schema, std::string_view input, std::string_view reference, const Options& options) {
+   Result result;
+   unique_ptr<Schema> parsedSchema;
+   if (!parseSchema(schema, parsedSchema, result)) {
+      return result;
+   }
+   util::StructuredFile inputFile("input", input.data(), input.data() + input.size());
+   util::StructuredFile referenceFile("reference", reference.data(), reference.data() + reference.size());
+   return compare(*parsedSchema, inputFile, referenceFile, options);
+}
+//---------------------------------------------------------------------------
+Result verifyRecords(std::string_view schema, const RecordProducer& input, std::string_view reference, const Options& options) {
+   Result result;
+   unique_ptr<Schema> parsedSchema;
+   if (!parseSchema(schema, parsedSchema, result)) {
+      return result;
+   }
+   util::StructuredFile inputFile("input", make_shared<util::RecordStream>(input));
+   util::StructuredFile referenceFile("reference", reference.data(), reference.data() + reference.size());
+   return compare(*parsedSchema, inputFile, referenceFile, options);
+}
+//---------------------------------------------------------------------------
+Result verifyFiles(const std::string& schemaFilename, const std::string& inputFilename, const std::string& referenceFilename, const Options& options) {
+   Result result;
+   unique_ptr<Schema> schema;
+   try {
+      util::MappedFile<char> file(schemaFilename);
+      if (!parseSchema(std::string_view(file.begin(), file.size), schema, result)) {
+         return result;
+      }
+      util::StructuredFile inputFile(inputFilename);
+      util::StructuredFile referenceFile(referenceFilename);
+      return compare(*schema, inputFile, referenceFile, options);
+   } catch (util::FileError& e) {
+      return failure(Error::Kind::File, e.what());
+   }
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#ifndef VERIFICATION_H_
+#define VERIFICATION_H_
+//---------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+//---------------------------------------------------------------------------
+// Verifies query results in process, linked as bin/libverify.a or bin/libverify.so. Schemas, inputs and references
+// use the format of the files of the command line tool. Nothing is printed and the process is never ended, all
+// problems are returned as errors of the result.
+namespace verify {
+//---------------------------------------------------------------------------
+// The options of the command line tool, with the same defaults
+struct Options {
+   // The first line of the input is a header, the reference always starts with one
+   bool ignoreFirstLine = true;
+   // Relative tolerance of decimals in percent, 0 or between 0.0001 and 100, for columns without a tolerance in the
+   // schema
+   double epsilon = 0.0;
+   bool trimStrings = false;
+   // Compares the whole result and lists the first maximumErrors mismatches, zero stops at the first one. Unordered
+   // comparisons always stop at the first one.
+   unsigned maximumErrors = 0;
+   // Compares input and reference as multisets of rows, exactly and therefore neither with an epsilon nor with a
+   // schema that declares tolerances, and neither in chunks nor pipelined
+   bool unordered = false;
+   size_t memoryBudget = size_t(1024) << 20;
+   // Compares chunks of mapped results on several threads, at most one per core. Ignored for schemas with sort keys,
+   // whose results are compared run by run of equal sort keys.
+   unsigned chunks = 1;
+   // Reads input and reference on threads of their own while comparing, not together with chunks > 1 and ignored for
+   // schemas with sort keys
+   bool pipelined = false;
+};
+//---------------------------------------------------------------------------
+struct Error {
+   enum class Kind {
+      // The input differs from the reference
+      Mismatch,
+      // The schema is malformed
+      Schema,
+      // A file could not be opened, read or decompressed
+      File,
+      // The options contradict each other or the schema
+      Options
+   };
+
+   Kind kind;
+   // As printed by the command line tool, e.g. "input:7<tab>expected 1995-03-12 got 2995-03-12"
+   std::string message;
+   // Line of the input or reference the mismatch was found in, 0 for other errors
+   uint64_t line = 0;
+   // Column of the mismatch, -1 if it concerns whole records
+   int field = -1;
+};
+//---------------------------------------------------------------------------
+struct Result {
+   // In the order in which they were found, at most Options::maximumErrors mismatches (or one) are listed
+   std::vector<Error> errors;
+   // Including the ones that are not listed
+   uint64_t numberOfMismatches = 0;
+   // Per column of the schema, the last entry counts mismatches of whole records
+   std::vector<uint64_t> mismatchesPerColumn;
+
+   bool matches() const {
+      return errors.empty();
+   }
+};
+//---------------------------------------------------------------------------
+// Sets record to the next record of the input, its fields separated by tabs and without the newline, and returns false
+// after the last one. The record only has to stay valid until the next call.
+typedef std::function<bool(std::string_view& record)> RecordProducer;
+//---------------------------------------------------------------------------
+// Compares results that are already in memory, without copying them. Messages refer to them as "input" and
+// "reference".
+Result verifyBuffers(std::string_view schema, std::string_view input, std::string_view reference, const Options& options = Options());
+// Compares the records of a producer, which usually have no header, i.e. options.ignoreFirstLine should be false
+Result verifyRecords(std::string_view schema, const RecordProducer& input, std::string_view reference, const Options& options = Options());
+// Compares the files of one result like the command line tool, compressed and streamed files included
+Result verifyFiles(const std::string& schemaFilename, const std::string& inputFilename, const std::string& referenceFilename, const Options& options = Options());
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+#endif
@@ -0,0 +1,363 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <stdlib.h>
+#include "NumberParser.hpp"
+#include "StructuredFile.hpp"
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+// Generates a synthetic result shaped like the TPC-H results and measures the throughput of the verifier and of its
+// stages on it
+class Benchmark {
+private:
+   enum class Type {
+      Integer, BigInt, Decimal, Date, Char, Varchar
+   };
+
+   struct Column {
+      Type type;
+      string name;
+      string schema;
+   };
+
+   struct Measurement {
+      string stage;
+      double seconds;
+      uint64_t bytes;
+      uint64_t rows;
+   };
+
+   uint64_t rows;
+   uint64_t mismatches;
+   unsigned runs;
+   unsigned seed;
+   string verifyPath;
+   vector<string> verifyArguments;
+   vector<Column> columns;
+   string directory;
+   uint64_t inputSize;
+   uint64_t referenceSize;
+   vector<Measurement> measurements;
+
+   void exitWithUsage(char *argv[]) {
+      cerr << "Usage: " << argv[0] << " [--rows N] [--mismatches N] [--types T,...] [--runs N] [--seed N] [--verify PATH] [-- verify options]" << endl;
+      cerr << "types are integer, bigint, decimal, date, char and varchar, one column each (default bigint,decimal,date,integer,char,varchar)" << endl;
+      exit(EXIT_FAILURE);
+   }
+
+   uint64_t parseNumber(int& argument, int argc, char *argv[]) {
+      int64_t value;
+      if (argument + 1 == argc || util::parseInt64(argv[argument + 1], value) != util::ParseStatus::Success || value < 0) {
+         exitWithUsage(argv);
+      }
+      ++argument;
+      return value;
+   }
+
+   void parseTypes(string types, char *argv[]) {
+      columns.clear();
+      stringstream stream(types);
+      string type;
+      while (getline(stream, type, ',')) {
+         string name = "c" + to_string(columns.size() + 1);
+         if (type == "integer") {
+            columns.push_back({Type::Integer, name, "integer not null"});
+         } else if (type == "bigint") {
+            columns.push_back({Type::BigInt, name, "bigint not null"});
+         } else if (type == "decimal") {
+            columns.push_back({Type::Decimal, name, "decimal(12,2) not null"});
+         } else if (type == "date") {
+            columns.push_back({Type::Date, name, "date not null"});
+         } else if (type == "char") {
+            columns.push_back({Type::Char, name, "char(1) not null"});
+         } else if (type == "varchar") {
+            columns.push_back({Type::Varchar, name, "varchar(25) not null"});
+         } else {
+            exitWithUsage(argv);
+         }
+      }
+      if (columns.empty()) {
+         exitWithUsage(argv);
+      }
+   }
+
+   void parseCommandLineArguments(int argc, char *argv[]) {
+      rows = 1000000;
+      mismatches = 0;
+      runs = 3;
+      seed = 42;
+      verifyPath = "bin/verify";
+      parseTypes("bigint,decimal,date,integer,char,varchar", argv);
+      for (int argument = 1; argument != argc; ++argument) {
+         string option = argv[argument];
+         if (option == "--rows") {
+            rows = parseNumber(argument, argc, argv);
+         } else if (option == "--mismatches") {
+            mismatches = parseNumber(argument, argc, argv);
+         } else if (option == "--runs") {
+            runs = max<uint64_t>(parseNumber(argument, argc, argv), 1);
+         } else if (option == "--seed") {
+            seed = parseNumber(argument, argc, argv);
+         } else if (option == "--types" && argument + 1 != argc) {
+            parseTypes(argv[++argument], argv);
+         } else if (option == "--verify" && argument + 1 != argc) {
+            verifyPath = argv[++argument];
+         } else if (option == "--") {
+            verifyArguments.assign(argv + argument + 1, argv + argc);
+            break;
+         } else {
+            exitWithUsage(argv);
+         }
+      }
+   }
+
+   void appendValue(string& row, Type type, mt19937_64& random) {
+      static const char* words[] = {"almond", "blush", "chiffon", "drab", "firebrick", "ghost", "honeydew", "lavender", "midnight", "papaya", "salmon", "thistle"};
+      char buffer[32];
+      switch (type) {
+         case Type::Integer:
+         row += to_string(random() % 1000000);
+         break;
+         case Type::BigInt:
+         row += to_string(random() % 6000000000ull);
+         break;
+         case Type::Decimal: {
+            uint64_t cents = random() % 10000000000ull;
+            snprintf(buffer, sizeof(buffer), "%llu.%02llu", static_cast<unsigned long long>(cents/100), static_cast<unsigned long long>(cents%100));
+            row += buffer;
+            break;
+         }
+         case Type::Date:
+         snprintf(buffer, sizeof(buffer), "%04u-%02u-%02u", unsigned(1992 + random()%7), unsigned(1 + random()%12), unsigned(1 + random()%28));
+         row += buffer;
+         break;
+         case Type::Char:
+         row += "ANR"[random()%3];
+         break;
+         case Type::Varchar:
+         row += words[random()%12];
+         row += ' ';
+         row += words[random()%12];
+         break;
+      }
+   }
+
+   // Changes one value of the row so that it no longer matches, the row stays valid for the schema
+   void mutateRow(string& row) {
+      char& last = row[row.size() - 2];
+      last = last == '9' ? '8' : last == 'z' ? 'y' : last + 1;
+   }
+
+   void writeFile(string filename, const string& content) {
+      FILE* file = fopen(filename.c_str(), "w");
+      if (!file || fwrite(content.data(), 1, content.size(), file) != content.size() || fclose(file) != 0) {
+         cerr << "failed to write " << filename << endl;
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   void generate() {
+      const char* temporary = getenv("TMPDIR");
+      directory = string(temporary ? temporary : "/tmp") + "/verify-bench-XXXXXX";
+      if (!mkdtemp(&directory[0])) {
+         cerr << "failed to create directory " << directory << endl;
+         exit(EXIT_FAILURE);
+      }
+      string schema;
+      string header;
+      for (auto& column : columns) {
+         schema += column.name + " " + column.schema + "\n";
+         header += (header.empty() ? "" : "\t") + column.name;
+      }
+      header += "\n";
+      mt19937_64 random(seed);
+      vector<uint64_t> mutated;
+      for (uint64_t mismatch = 0; mismatch != mismatches; ++mismatch) {
+         mutated.push_back(random() % rows);
+      }
+      sort(mutated.begin(), mutated.end());
+      string reference = header;
+      string input = header;
+      string row;
+      auto nextMutation = mutated.begin();
+      for (uint64_t line = 0; line != rows; ++line) {
+         row.clear();
+         for (size_t column = 0; column != columns.size(); ++column) {
+            if (column) {
+               row += '\t';
+            }
+            appendValue(row, columns[column].type, random);
+         }
+         row += '\n';
+         reference += row;
+         if (nextMutation != mutated.end() && *nextMutation == line) {
+            mutateRow(row);
+            while (nextMutation != mutated.end() && *nextMutation == line) {
+               ++nextMutation;
+            }
+         }
+         input += row;
+      }
+      for (string subdirectory : {"/in", "/ref", "/sch"}) {
+         mkdir((directory + subdirectory).c_str(), 0700);
+      }
+      writeFile(directory + "/in/bench.txt", input);
+      writeFile(directory + "/ref/bench.txt", reference);
+      writeFile(directory + "/sch/bench.txt", schema);
+      inputSize = input.size();
+      referenceSize = reference.size();
+   }
+
+   void removeFiles() {
+      for (string subdirectory : {"/in", "/ref", "/sch"}) {
+         unlink((directory + subdirectory + "/bench.txt").c_str());
+         rmdir((directory + subdirectory).c_str());
+      }
+      rmdir(directory.c_str());
+   }
+
+   // Runs the stage the configured number of times and keeps the fastest run
+   template <typename Function>
+   void measure(string stage, uint64_t bytes, Function function) {
+      double best = 0;
+      for (unsigned run = 0; run != runs; ++run) {
+         auto start = chrono::steady_clock::now();
+         function();
+         double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+         best = run == 0 ? seconds : min(best, seconds);
+      }
+      measurements.push_back({stage, best, bytes, rows});
+   }
+
+   // Splits the reference into fields
+   uint64_t tokenize() {
+      util::StructuredFile file(directory + "/ref/bench.txt");
+      uint64_t fields = 0;
+      string_view field;
+      while (file.nextRecord() == util::StructuredFile::Status::Success) {
+         while (file.nextField(field) == util::StructuredFile::Status::Success) {
+            ++fields;
+         }
+      }
+      return fields;
+   }
+
+   // Splits the reference into fields and parses the numbers and dates
+   uint64_t parse() {
+      util::StructuredFile file(directory + "/ref/bench.txt");
+      uint64_t checksum = 0;
+      string_view field;
+      while (file.nextRecord() == util::StructuredFile::Status::Success) {
+         for (auto& column : columns) {
+            if (file.nextField(field) != util::StructuredFile::Status::Success) {
+               break;
+            }
+            int32_t small = 0;
+            int64_t big = 0;
+            switch (column.type) {
+               case Type::Integer:
+               util::parseInt32(field, small);
+               break;
+               case Type::BigInt:
+               util::parseInt64(field, big);
+               break;
+               case Type::Decimal: {
+                  size_t dot = field.find('.');
+                  util::parseInt64(field.substr(0, dot), big);
+                  util::parseInt32(dot == string_view::npos ? string_view() : field.substr(dot + 1), small);
+                  break;
+               }
+               case Type::Date:
+               util::parseDate(field, small);
+               break;
+               default:
+               big = field.size();
+            }
+            checksum += small + big;
+         }
+      }
+      return checksum;
+   }
+
+   // Runs the verifier on the generated files, returns its exit status
+   int verify() {
+      vector<string> arguments{verifyPath};
+      arguments.insert(arguments.end(), verifyArguments.begin(), verifyArguments.end());
+      arguments.insert(arguments.end(), {directory + "/in", directory + "/ref", directory + "/sch"});
+      vector<char*> argv;
+      for (auto& argument : arguments) {
+         argv.push_back(&argument[0]);
+      }
+      argv.push_back(nullptr);
+      pid_t child = fork();
+      if (child == 0) {
+         int devNull = open("/dev/null", O_WRONLY);
+         dup2(devNull, STDOUT_FILENO);
+         dup2(devNull, STDERR_FILENO);
+         execv(verifyPath.c_str(), argv.data());
+         _exit(127);
+      }
+      int status;
+      if (child == -1 || waitpid(child, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+         cerr << "failed to run " << verifyPath << endl;
+         removeFiles();
+         exit(EXIT_FAILURE);
+      }
+      return WEXITSTATUS(status);
+   }
+
+   void report(int verifyStatus) {
+      cout << rows << " rows, " << columns.size() << " columns, " << mismatches << " mismatches, " << inputSize + referenceSize << " bytes" << endl;
+      cout << left << setw(12) << "stage" << right << setw(12) << "seconds" << setw(12) << "GB/s" << setw(16) << "rows/s" << endl;
+      for (auto& measurement : measurements) {
+         double seconds = max(measurement.seconds, 1e-9);
+         cout << left << setw(12) << measurement.stage << right << fixed
+              << setw(12) << setprecision(4) << measurement.seconds
+              << setw(12) << setprecision(3) << measurement.bytes/seconds/1e9
+              << setw(16) << setprecision(0) << measurement.rows/seconds << endl;
+      }
+      cout << "verify " << (verifyStatus == EXIT_SUCCESS ? "passed" : "failed") << endl;
+   }
+
+public:
+   Benchmark(int argc, char *argv[]) {
+      parseCommandLineArguments(argc, argv);
+   }
+
+   void run() {
+      auto start = chrono::steady_clock::now();
+      generate();
+      measurements.push_back({"generate", chrono::duration<double>(chrono::steady_clock::now() - start).count(), inputSize + referenceSize, rows});
+      volatile uint64_t sink;
+      measure("tokenize", referenceSize, [&]() { sink = tokenize(); });
+      measure("parse", referenceSize, [&]() { sink = parse(); });
+      int verifyStatus = 0;
+      measure("verify", inputSize + referenceSize, [&]() { verifyStatus = verify(); });
+      (void) sink;
+      removeFiles();
+      report(verifyStatus);
+   }
+};
+//---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+   Benchmark benchmark(argc, argv);
+   benchmark.run();
+   return EXIT_SUCCESS;
+}
+//---------------------------------------------------------------------------
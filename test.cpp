@@ -0,0 +1,404 @@
+//---------------------------------------------------------------------------
+// (c) 2014 Wolf Roediger <roediger@in.tum.de>
+//---------------------------------------------------------------------------
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <stdlib.h>
+#include "Comparison.hpp"
+#include "NumberParser.hpp"
+#include "StructuredFile.hpp"
+#include "Verification.hpp"
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+// Checks that fail are printed with their line, the test exits with 1 if there were any
+static unsigned failures = 0;
+#define CHECK(condition) check(condition, #condition, __LINE__)
+//---------------------------------------------------------------------------
+static void check(bool condition, const char* expression, int line) {
+   if (!condition) {
+      cerr << "test.cpp:" << line << ": failed " << expression << endl;
+      ++failures;
+   }
+}
+//---------------------------------------------------------------------------
+static bool parsesInt64(string_view input, int64_t expected) {
+   int64_t value;
+   return util::parseInt64(input, value) == util::ParseStatus::Success && value == expected;
+}
+//---------------------------------------------------------------------------
+static util::ParseStatus statusOfInt64(string_view input) {
+   int64_t value;
+   return util::parseInt64(input, value);
+}
+//---------------------------------------------------------------------------
+static bool parsesDecimal(string_view input, int scale, util::Decimal128 expected) {
+   util::Decimal128 value;
+   return util::parseDecimal(input, scale, value) == util::ParseStatus::Success && value == expected;
+}
+//---------------------------------------------------------------------------
+static util::ParseStatus statusOfDecimal(string_view input, int scale) {
+   util::Decimal128 value;
+   return util::parseDecimal(input, scale, value);
+}
+//---------------------------------------------------------------------------
+static void testIntegers() {
+   using util::ParseStatus;
+   CHECK(parsesInt64("0", 0));
+   CHECK(parsesInt64(" -42\t", -42));
+   CHECK(parsesInt64("+7", 7));
+   CHECK(statusOfInt64("") == ParseStatus::Malformed);
+   CHECK(statusOfInt64("-") == ParseStatus::Malformed);
+   CHECK(statusOfInt64("12a") == ParseStatus::Malformed);
+   CHECK(statusOfInt64("1234567a") == ParseStatus::Malformed);
+   // The limits and one past each
+   CHECK(parsesInt64("9223372036854775807", INT64_MAX));
+   CHECK(parsesInt64("9223372036854775806", INT64_MAX - 1));
+   CHECK(statusOfInt64("9223372036854775808") == ParseStatus::Overflow);
+   CHECK(parsesInt64("-9223372036854775808", INT64_MIN));
+   CHECK(parsesInt64("-9223372036854775807", INT64_MIN + 1));
+   CHECK(statusOfInt64("-9223372036854775809") == ParseStatus::Overflow);
+   // 2^64 and 2^64 + 10^8 wrap around to small values if the eight digit steps are not checked
+   CHECK(statusOfInt64("18446744073709551616") == ParseStatus::Overflow);
+   CHECK(statusOfInt64("000018446744073709551616") == ParseStatus::Overflow);
+   CHECK(statusOfInt64("18446744073809551616") == ParseStatus::Overflow);
+   CHECK(statusOfInt64("18446744073709551615") == ParseStatus::Overflow);
+   CHECK(parsesInt64("0000000000000000000000000042", 42));
+   // One, two and a half words of digits
+   CHECK(parsesInt64("1234567890123456", 1234567890123456));
+   CHECK(parsesInt64("12345678901234567", 12345678901234567));
+   CHECK(statusOfInt64("12345678901234567890") == ParseStatus::Overflow);
+   CHECK(statusOfInt64("123456789012345678901") == ParseStatus::Overflow);
+   CHECK(parsesInt64("-1234567890123456789", -1234567890123456789));
+
+   int32_t value;
+   CHECK(util::parseInt32("2147483647", value) == ParseStatus::Success && value == INT32_MAX);
+   CHECK(util::parseInt32("2147483648", value) == ParseStatus::Overflow);
+   CHECK(util::parseInt32("-2147483648", value) == ParseStatus::Success && value == INT32_MIN);
+   CHECK(util::parseInt32("-2147483649", value) == ParseStatus::Overflow);
+}
+//---------------------------------------------------------------------------
+static void testDates() {
+   using util::ParseStatus;
+   int32_t days;
+   CHECK(util::parseDate("1970-01-01", days) == ParseStatus::Success && days == 0);
+   CHECK(util::parseDate("2000-02-29", days) == ParseStatus::Success && days == 11016);
+   CHECK(util::parseDate("1969-12-31", days) == ParseStatus::Success && days == -1);
+   CHECK(util::parseDate("1900-02-29", days) == ParseStatus::Malformed);
+   CHECK(util::parseDate("1995-13-01", days) == ParseStatus::Malformed);
+   CHECK(util::parseDate("1995-04-31", days) == ParseStatus::Malformed);
+   CHECK(util::parseDate("1995-4-30", days) == ParseStatus::Malformed);
+}
+//---------------------------------------------------------------------------
+static void testDecimals() {
+   using util::ParseStatus;
+   const util::Decimal128 largest = static_cast<util::Decimal128>(util::powerOfTen(38) - 1);
+   CHECK(parsesDecimal("1.5", 2, 150));
+   CHECK(parsesDecimal("-0.05", 2, -5));
+   CHECK(parsesDecimal(".5", 1, 5));
+   CHECK(parsesDecimal("5.", 1, 50));
+   CHECK(statusOfDecimal(".", 1) == ParseStatus::Malformed);
+   CHECK(statusOfDecimal("1.2.3", 2) == ParseStatus::Malformed);
+   // Further fraction digits are rounded half away from zero
+   CHECK(parsesDecimal("1.005", 2, 101));
+   CHECK(parsesDecimal("-1.005", 2, -101));
+   CHECK(parsesDecimal("1.00499", 2, 100));
+   // 38 digits fit, 39 and 40 do not, neither do 2^128 and 2^128 + 1 which wrap around to small values
+   CHECK(parsesDecimal("99999999999999999999999999999999999999", 0, largest));
+   CHECK(parsesDecimal("-99999999999999999999999999999999999999", 0, -largest));
+   CHECK(statusOfDecimal("100000000000000000000000000000000000000", 0) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("999999999999999999999999999999999999999", 0) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("9999999999999999999999999999999999999999", 0) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("340282366920938463463374607431768211456", 0) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("340282366920938463463374607431768211457", 0) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("99999999999999999999999999999999999999.5", 0) == ParseStatus::Overflow);
+   // The fraction and the padding to the scale count towards the 38 digits
+   CHECK(parsesDecimal("999999999999999999999999999999999999.99", 2, largest));
+   CHECK(statusOfDecimal("9999999999999999999999999999999999999.99", 2) == ParseStatus::Overflow);
+   CHECK(parsesDecimal("999999999999999999999999999999999999", 2, largest - 99));
+   CHECK(statusOfDecimal("9999999999999999999999999999999999999", 2) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("99999999999999999999999999999999999999", 1) == ParseStatus::Overflow);
+   CHECK(statusOfDecimal("3402823669209384634633746074317682114", 2) == ParseStatus::Overflow);
+}
+//---------------------------------------------------------------------------
+static void testTolerances() {
+   Tolerance absolute;
+   absolute.kind = Tolerance::Kind::Absolute;
+   absolute.value = 5;
+   CHECK(absolute.allows(100, 105));
+   CHECK(absolute.allows(-100, -95));
+   CHECK(!absolute.allows(100, 106));
+   CHECK(!Tolerance().allows(100, 101));
+   CHECK(Tolerance().allows(-3, -3));
+
+   // 1% of the reference
+   Tolerance relative = Tolerance::relative(1.0);
+   CHECK(relative.value == 10000);
+   CHECK(relative.allows(101, 100));
+   CHECK(relative.allows(-99, -100));
+   CHECK(!relative.allows(102, 100));
+   CHECK(!relative.allows(1, 0));
+   // Exact at the limits of decimal(38)
+   const util::Decimal128 largest = static_cast<util::Decimal128>(util::powerOfTen(38) - 1);
+   CHECK(relative.allows(largest - largest/100, largest));
+   CHECK(!relative.allows(-largest, largest));
+   CHECK(Tolerance::isValidRelative(0.0001));
+   CHECK(!Tolerance::isValidRelative(0.00001));
+   CHECK(!Tolerance::isValidRelative(100.5));
+
+   // As declared in schemas: absolute, relative and in units of the last place
+   string absoluteSchema = "b decimal(12,2) not null tolerance 0.05\n";
+   CHECK(verify::verifyBuffers(absoluteSchema, "b\n10.05\n", "b\n10.00\n").matches());
+   CHECK(!verify::verifyBuffers(absoluteSchema, "b\n10.06\n", "b\n10.00\n").matches());
+   string relativeSchema = "b decimal(12,2) not null tolerance 0.5%\n";
+   CHECK(verify::verifyBuffers(relativeSchema, "b\n100.50\n", "b\n100.00\n").matches());
+   CHECK(!verify::verifyBuffers(relativeSchema, "b\n100.51\n", "b\n100.00\n").matches());
+   string ulpSchema = "b decimal(12,2) not null tolerance 2 ulp\n";
+   CHECK(verify::verifyBuffers(ulpSchema, "b\n1.02\n", "b\n1.00\n").matches());
+   CHECK(!verify::verifyBuffers(ulpSchema, "b\n1.03\n", "b\n1.00\n").matches());
+   // Records of equal sort keys pair up by value, although 10.03 sorts before 9.99 as text
+   string sortedSchema = "a integer not null sort key\nb decimal(12,2) not null tolerance 0.05\n";
+   CHECK(verify::verifyBuffers(sortedSchema, "a\tb\n1\t10.49\n1\t10.03\n2\t1.00\n", "a\tb\n1\t9.99\n1\t10.50\n2\t1.00\n").matches());
+   CHECK(!verify::verifyBuffers(sortedSchema, "a\tb\n1\t10.49\n1\t10.10\n2\t1.00\n", "a\tb\n1\t9.99\n1\t10.50\n2\t1.00\n").matches());
+   // Tolerances that would be rounded, exceed 100% or belong to other types are rejected
+   for (string schema : {"b decimal(12,2) tolerance 0.001\n", "b decimal(12,2) tolerance 101%\n", "a integer tolerance 1\n"}) {
+      auto result = verify::verifyBuffers(schema, "b\n1\n", "b\n1\n");
+      CHECK(result.errors.size() == 1 && result.errors[0].kind == verify::Error::Kind::Schema);
+   }
+}
+//---------------------------------------------------------------------------
+static void testBuffers() {
+   const string schema = "a integer not null\nb decimal(12,2)\nc varchar(10)\nd date\n";
+   const string reference = "a\tb\tc\td\n1\t1.50\tx\t1995-03-12\n2\tnull\ty\t1996-01-01\n3\t-0.25\tz\tnull\n";
+   CHECK(verify::verifyBuffers(schema, reference, reference).matches());
+   CHECK(verify::verifyBuffers(schema, "a\tb\tc\td\n1\t1.5\tx\t1995-03-12\n2\tnull\ty\t1996-01-01\n3\t-.25\tz\tnull\n", reference).matches());
+
+   auto result = verify::verifyBuffers(schema, "a\tb\tc\td\n1\t1.50\tx\t2995-03-12\n2\tnull\ty\t1996-01-01\n3\t-0.25\tw\tnull\n", reference);
+   CHECK(result.errors.size() == 1 && result.errors[0].kind == verify::Error::Kind::Mismatch && result.errors[0].line == 2 && result.errors[0].field == 3);
+
+   verify::Options options;
+   options.maximumErrors = 10;
+   result = verify::verifyBuffers(schema, "a\tb\tc\td\n1\t1.50\tx\t2995-03-12\n2\tnull\ty\t1996-01-01\n3\t-0.25\tw\tnull\n", reference, options);
+   CHECK(result.numberOfMismatches == 2 && result.errors.size() == 2);
+   CHECK(result.mismatchesPerColumn.size() == 5 && result.mismatchesPerColumn[2] == 1 && result.mismatchesPerColumn[3] == 1);
+
+   // Missing and additional records
+   CHECK(!verify::verifyBuffers(schema, "a\tb\tc\td\n1\t1.50\tx\t1995-03-12\n", reference).matches());
+   CHECK(!verify::verifyBuffers(schema, reference + "4\t0\tq\tnull\n", reference).matches());
+
+   // Unordered comparisons, also when the rows spill to disk
+   const string shuffled = "a\tb\tc\td\n3\t-0.25\tz\tnull\n1\t1.50\tx\t1995-03-12\n2\tnull\ty\t1996-01-01\n";
+   verify::Options unordered;
+   unordered.unordered = true;
+   CHECK(!verify::verifyBuffers(schema, shuffled, reference).matches());
+   CHECK(verify::verifyBuffers(schema, shuffled, reference, unordered).matches());
+   string manyReference = "a\tb\tc\td\n";
+   string manyInput = manyReference;
+   for (int row = 0; row != 20000; ++row) {
+      manyReference += to_string(row) + "\t" + to_string(row % 100) + ".5\tv" + to_string(row % 7) + "\tnull\n";
+      manyInput += to_string(19999 - row) + "\t" + to_string((19999 - row) % 100) + ".5\tv" + to_string((19999 - row) % 7) + "\tnull\n";
+   }
+   unordered.memoryBudget = 64 << 10;
+   CHECK(verify::verifyBuffers(schema, manyInput, manyReference, unordered).matches());
+   CHECK(!verify::verifyBuffers(schema, manyInput + "20000\t0\tv\tnull\n", manyReference, unordered).matches());
+
+   // Chunks of the comparison split inside of the records, the mismatch is in the last one
+   verify::Options chunked;
+   chunked.chunks = 7;
+   CHECK(verify::verifyBuffers(schema, manyReference, manyReference, chunked).matches());
+   string lastDiffers = manyReference;
+   lastDiffers[lastDiffers.size() - 7] = 'w';
+   result = verify::verifyBuffers(schema, lastDiffers, manyReference, chunked);
+   CHECK(result.errors.size() == 1 && result.errors[0].line == 20001 && result.errors[0].field == 2);
+   verify::Options pipelined;
+   pipelined.pipelined = true;
+   CHECK(!verify::verifyBuffers(schema, lastDiffers, manyReference, pipelined).matches());
+
+   // Options that contradict each other or the schema
+   verify::Options contradicting = unordered;
+   contradicting.chunks = 2;
+   result = verify::verifyBuffers(schema, reference, reference, contradicting);
+   CHECK(result.errors.size() == 1 && result.errors[0].kind == verify::Error::Kind::Options);
+   contradicting = unordered;
+   contradicting.epsilon = 1.0;
+   result = verify::verifyBuffers(schema, reference, reference, contradicting);
+   CHECK(result.errors.size() == 1 && result.errors[0].kind == verify::Error::Kind::Options);
+   result = verify::verifyBuffers("a integr\n", reference, reference);
+   CHECK(result.errors.size() == 1 && result.errors[0].kind == verify::Error::Kind::Schema);
+}
+//---------------------------------------------------------------------------
+// Files of one result in a temporary directory, removed with it
+class ResultFiles {
+public:
+   string directory;
+   string schemaFilename;
+   string inputFilename;
+   string referenceFilename;
+
+   ResultFiles(const string& schema, const string& input, const string& reference) {
+      char name[] = "/tmp/verify-test-XXXXXX";
+      directory = mkdtemp(name);
+      schemaFilename = directory + "/schema";
+      inputFilename = directory + "/input";
+      referenceFilename = directory + "/reference";
+      write(schemaFilename, schema);
+      write(inputFilename, input);
+      write(referenceFilename, reference);
+   }
+
+   ~ResultFiles() {
+      for (auto& filename : {schemaFilename, inputFilename, referenceFilename, CompiledReference::filenameOf(referenceFilename), referenceFilename + ".digest"}) {
+         unlink(filename.c_str());
+      }
+      rmdir(directory.c_str());
+   }
+
+   static void write(const string& filename, const string& data) {
+      ofstream(filename, ios::binary | ios::trunc) << data;
+   }
+
+   static string read(const string& filename) {
+      ifstream file(filename, ios::binary);
+      return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+   }
+};
+//---------------------------------------------------------------------------
+// Compares the input against the compiled reference, returns false if there is none or the input differs
+static bool compareCompiled(Schema& schema, ResultFiles& files) {
+   util::StructuredFile inputFile(files.inputFilename);
+   util::StructuredFile referenceFile(files.referenceFilename);
+   auto compiled = CompiledReference::load(schema, referenceFile);
+   if (!compiled) {
+      return false;
+   }
+   try {
+      ComparisonPlan(schema, 0.0, false).compare(inputFile, referenceFile, compiled.get());
+      return true;
+   } catch (SchemaException&) {
+      return false;
+   }
+}
+//---------------------------------------------------------------------------
+static bool isCompiled(Schema& schema, const string& referenceFilename, bool ignoreFirstLine = true) {
+   util::StructuredFile referenceFile(referenceFilename);
+   referenceFile.ignoreFirstLine = ignoreFirstLine;
+   return CompiledReference::load(schema, referenceFile) != nullptr;
+}
+//---------------------------------------------------------------------------
+static void testCompiledReferences() {
+   const string schemaText = "a integer not null\nb decimal(12,2)\nc varchar(10)\nd date\n";
+   string reference = "a\tb\tc\td\n";
+   for (int row = 0; row != 1000; ++row) {
+      reference += to_string(row) + "\t" + to_string(row % 50) + ".25\tv" + to_string(row % 13) + "\t" + (row % 3 ? "1995-03-12" : "null") + "\n";
+   }
+   ResultFiles files(schemaText, reference, reference);
+   Schema schema(schemaText.data(), schemaText.data() + schemaText.size());
+   {
+      util::StructuredFile referenceFile(files.referenceFilename);
+      CHECK(CompiledReference::compile(schema, referenceFile) == 1000);
+   }
+   CHECK(compareCompiled(schema, files));
+   string differing = reference;
+   differing.replace(differing.find("\t7.25\t"), 6, "\t7.26\t");
+   ResultFiles::write(files.inputFilename, differing);
+   CHECK(!compareCompiled(schema, files) && isCompiled(schema, files.referenceFilename));
+   ResultFiles::write(files.inputFilename, reference);
+
+   // Other schemas, sort keys, tolerances and first line settings do not match the compiled form
+   for (string otherText : {"a bigint not null\nb decimal(12,2)\nc varchar(10)\nd date\n", "a integer not null sort key\nb decimal(12,2)\nc varchar(10)\nd date\n", "a integer not null\nb decimal(12,2) tolerance 0.01\nc varchar(10)\nd date\n"}) {
+      Schema other(otherText.data(), otherText.data() + otherText.size());
+      CHECK(!isCompiled(other, files.referenceFilename));
+   }
+   CHECK(!isCompiled(schema, files.referenceFilename, false));
+
+   // Truncated or corrupted compiled files are not used
+   string compiledFilename = CompiledReference::filenameOf(files.referenceFilename);
+   string compiled = ResultFiles::read(compiledFilename);
+   ResultFiles::write(compiledFilename, compiled.substr(0, compiled.size()/2));
+   CHECK(!isCompiled(schema, files.referenceFilename));
+   // The magic, the size and time of the reference and the fingerprint of the schema
+   for (size_t offset : {0, 8, 16, 24, 32}) {
+      string corrupted = compiled;
+      corrupted[offset] ^= 0x55;
+      ResultFiles::write(compiledFilename, corrupted);
+      CHECK(!isCompiled(schema, files.referenceFilename));
+   }
+   // Nor are those of an older reference
+   ResultFiles::write(compiledFilename, compiled);
+   CHECK(isCompiled(schema, files.referenceFilename));
+   ResultFiles::write(files.referenceFilename, reference + "1001\t1.25\tv\tnull\n");
+   CHECK(!isCompiled(schema, files.referenceFilename));
+}
+//---------------------------------------------------------------------------
+// Compares the input against the digests of the reference, which are created on the first call
+static bool compareDigests(Schema& schema, ResultFiles& files) {
+   util::StructuredFile inputFile(files.inputFilename);
+   util::StructuredFile referenceFile(files.referenceFilename);
+   try {
+      DigestComparison(schema, 0.0, false).compare(inputFile, referenceFile);
+      return true;
+   } catch (SchemaException&) {
+      return false;
+   }
+}
+//---------------------------------------------------------------------------
+static void testDigests() {
+   const string schemaText = "a bigint not null\nb decimal(12,2)\nc char(3)\n";
+   string reference = "a\tb\tc\n";
+   for (int row = 0; row != 200000; ++row) {
+      reference += to_string(row) + "\t" + to_string(row % 1000) + ".5\tx" + to_string(row % 10) + "\n";
+   }
+   ResultFiles files(schemaText, reference, reference);
+   Schema schema(schemaText.data(), schemaText.data() + schemaText.size());
+   string digestFilename = files.referenceFilename + ".digest";
+   CHECK(compareDigests(schema, files));
+   string digests = ResultFiles::read(digestFilename);
+   CHECK(!digests.empty());
+   // The same values in another notation match, one differing value in a later chunk does not
+   string equivalent = reference;
+   equivalent.replace(equivalent.find("\n150000\t0.5\t"), 12, "\n150000\t.50\t");
+   ResultFiles::write(files.inputFilename, equivalent);
+   CHECK(compareDigests(schema, files));
+   string differing = reference;
+   differing.replace(differing.find("\n150000\t0.5\t"), 12, "\n150000\t0.6\t");
+   ResultFiles::write(files.inputFilename, differing);
+   CHECK(!compareDigests(schema, files));
+   CHECK(ResultFiles::read(digestFilename) == digests);
+
+   // Corrupted digests only make chunks look different, they are then compared field by field
+   string corrupted = digests;
+   corrupted[corrupted.size() - 3] ^= 0x55;
+   ResultFiles::write(digestFilename, corrupted);
+   ResultFiles::write(files.inputFilename, reference);
+   CHECK(compareDigests(schema, files));
+   ResultFiles::write(files.inputFilename, differing);
+   CHECK(!compareDigests(schema, files));
+   // Truncated ones and those of other schemas are rebuilt
+   ResultFiles::write(digestFilename, digests.substr(0, digests.size() - 1));
+   CHECK(!compareDigests(schema, files) && ResultFiles::read(digestFilename) == digests);
+   const string otherText = "a bigint not null sort key\nb decimal(12,2)\nc char(3)\n";
+   Schema other(otherText.data(), otherText.data() + otherText.size());
+   ResultFiles::write(files.inputFilename, reference);
+   CHECK(compareDigests(other, files) && ResultFiles::read(digestFilename) != digests);
+}
+//---------------------------------------------------------------------------
+int main() {
+   testIntegers();
+   testDates();
+   testDecimals();
+   testTolerances();
+   testBuffers();
+   testCompiledReferences();
+   testDigests();
+   if (failures) {
+      cerr << failures << " checks failed" << endl;
+      return EXIT_FAILURE;
+   }
+   cout << "all checks passed" << endl;
+   return EXIT_SUCCESS;
+}
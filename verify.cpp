@@ -2,490 +2,384 @@
 // (c) 2014 Wolf Roediger <roediger@in.tum.de>
 //---------------------------------------------------------------------------
 #include <algorithm>
+#include <atomic>
 #include <cctype>
-#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
 #include <dirent.h>
-#include <functional>
+#include <exception>
+#include <iomanip>
 #include <iostream>
-#include <locale>
+#include <limits>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 #include <stdlib.h>
-#include "MappedFile.hpp"
+#include "Comparison.hpp"
+#include "Json.hpp"
+#include "Statistics.hpp"
 #include "StructuredFile.hpp"
+#include "ThreadPool.hpp"
+#include "Verification.hpp"
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
-class Attribute {
-public:
-   enum class Type {
-      Integer, BigInt, Varchar, Char, Decimal, Date
-   };
-   string name;
-   Type type;
-   int length = -1;
-   int precision = -1;
-   bool null = true;
-};
-//---------------------------------------------------------------------------
-enum class ParserState {
-   Name, Type, TypeLength, TypePrecision, NullInfo, EndOfAttribute
-};
+// Exit status of runs without mismatches in which --sample left differing chunks uncompared
+constexpr int exitUnverified = 2;
 //---------------------------------------------------------------------------
-class SchemaException : public runtime_error {
+// Ends a verification after its reason was printed, e.g. the usage or a missing file
+class VerificationAborted : public runtime_error {
 public:
-   SchemaException(string message) : runtime_error(message) {}
+   VerificationAborted(string reason = "verification aborted") : runtime_error(reason) {}
 };
 //---------------------------------------------------------------------------
-class SchemaInputFileException : public runtime_error {
+// Schemas, mapped references and their compiled forms that the server keeps between requests. Entries are checked
+// against the size and modification time of their files, and the least recently used ones are dropped once the cached
+// files exceed the budget. Only references that are mapped as a whole are cached.
+class ResultCache {
 public:
-   SchemaInputFileException(string message) : runtime_error(message) {}
-};
-//---------------------------------------------------------------------------
-class SchemaReferenceFileException : public runtime_error {
-public:
-   SchemaReferenceFileException(string message) : runtime_error(message) {}
-};
-//---------------------------------------------------------------------------
-class Schema {
+   // Requests copy the file before reading it, so the cached one always starts at the beginning
+   struct Reference {
+      util::StructuredFile file;
+      shared_ptr<CompiledReference> compiled;
+   };
+
 private:
-   vector<Attribute> attributes;
-   int numberOfAttributes;
-
-   void throwError(util::StructuredFile& inputFile, string message, int field = -1) {
-      stringstream stream;
-      stream << inputFile.getFilename() << ":" << inputFile.getLineNumber() << "\t";
-      if (field > -1) {
-         stream << attributes[field].name << ": ";
-      }
-      stream << message;
-      throw SchemaException(stream.str());
-   }
-
-   pair<uint64_t, uint64_t> parseDecimal(string decimalString, int maxLength, int precision) {
-      pair<uint64_t, uint64_t> decimal{0, 0};
-      bool fraction = false;
-      int length = 0;
-      int decimalPlaces = 0;
-      for (char digit : decimalString) {
-         if (digit == '.') {
-            fraction = true;
-            continue;
-         }
-         if (fraction) {
-            ++decimalPlaces;
-            int decimalPlace = digit - '0';
-            if (decimalPlaces == precision + 1) {
-               if (decimalPlace > 4) {
-                  ++decimal.second;
-               }
-               break;
-            } else {
-               decimal.second = decimal.second*10 + digit - '0';
-            }
-         } else {
-            ++length;
-            decimal.first = decimal.first*10 + digit - '0';
-            if (false && length > maxLength) { // Do not check length
-               throw SchemaException("decimal field exceeds length");
-            }
-         }
-      }
-      for (; decimalPlaces < precision; ++decimalPlaces) {
-         decimal.second *= 10;
-      }
-      return decimal;
-   }
+   // Size and modification time in nanoseconds
+   typedef pair<uint64_t, int64_t> Stamp;
 
-   bool compareInteger(string input, string reference) {
-      return stoi(input) == stoi(reference);
-   }
+   struct Entry {
+      string key;
+      // Of every file the entry was built from
+      vector<Stamp> stamps;
+      uint64_t bytes;
+      shared_ptr<Schema> schema;
+      shared_ptr<Reference> reference;
+   };
 
-   bool compareBigInt(string input, string reference) {
-      return stol(input) == stol(reference);
-   }
+   size_t budget;
+   size_t used;
+   mutex entriesMutex;
+   // Most recently used first
+   list<Entry> entries;
+   unordered_map<string, list<Entry>::iterator> index;
 
-   static inline string &ltrim(string &input) {
-      input.erase(input.begin(), find_if(input.begin(), input.end(), not1(ptr_fun<int, int>(isspace))));
-      return input;
+   static Stamp stamp(const string& filename) {
+      struct stat statistics;
+      if (stat(filename.c_str(), &statistics) != 0) {
+         return {0, -1};
+      }
+      return {statistics.st_size, statistics.st_mtim.tv_sec * 1000000000ll + statistics.st_mtim.tv_nsec};
    }
 
-   static inline string &rtrim(string &input) {
-      input.erase(find_if(input.rbegin(), input.rend(), not1(ptr_fun<int, int>(isspace))).base(), input.end());
-      return input;
+   // Requests run in the working directory of their client, so entries are keyed by absolute paths
+   static string absolutePath(const string& filename) {
+      char* path = realpath(filename.c_str(), nullptr);
+      if (!path) {
+         return "";
+      }
+      string result = path;
+      free(path);
+      return result;
    }
 
-   static inline string &trim(string &input) {
-      return ltrim(rtrim(input));
+   void erase(list<Entry>::iterator entry) {
+      used -= entry->bytes;
+      index.erase(entry->key);
+      entries.erase(entry);
    }
 
-   bool compareVarchar(string input, string reference, int length, bool trimStrings) {
-      if (trimStrings) {
-         input = trim(input);
-         reference = trim(reference);
+   // Copies the entry for key if it is up to date, it becomes the most recently used one
+   bool find(const string& key, const vector<Stamp>& stamps, Entry& result) {
+      lock_guard<mutex> lock(entriesMutex);
+      auto entry = index.find(key);
+      if (entry == index.end()) {
+         return false;
       }
-      if (input.length() > length) {
-         throw SchemaInputFileException("varchar field exceeds length");
+      if (entry->second->stamps != stamps) {
+         erase(entry->second);
+         return false;
       }
-      if (reference.length() > length) {
-         throw SchemaReferenceFileException("varchar field exceeds length");
-      }
-      return input == reference;
+      entries.splice(entries.begin(), entries, entry->second);
+      result = entries.front();
+      return true;
    }
 
-   bool compareChar(string input, string reference, int length, bool trimStrings) {
-      if (input.length() > length) {
-         throw SchemaInputFileException("character field exceeds length");
-      }
-      if (reference.length() > length) {
-         throw SchemaReferenceFileException("character field exceeds length");
+   // Entries are built outside of the lock, so a concurrent request may have inserted the same key in the meantime
+   void insert(Entry entry) {
+      lock_guard<mutex> lock(entriesMutex);
+      auto existing = index.find(entry.key);
+      if (existing != index.end()) {
+         erase(existing->second);
       }
-      if (trimStrings) {
-         return trim(input) == trim(reference);
-      } else {
-         return input == reference;
+      used += entry.bytes;
+      entries.push_front(move(entry));
+      index[entries.front().key] = entries.begin();
+      while (used > budget && entries.size() > 1) {
+         erase(prev(entries.end()));
       }
    }
 
-   double fractionToDouble(int fraction) {
-      int numberOfDigits = 1;
-      if (fraction != 0) {
-         numberOfDigits = floor(log10(abs(fraction))) + 1;
+public:
+   ResultCache(size_t budget) : budget(budget), used(0) {}
+
+   shared_ptr<Schema> getSchema(const string& filename) {
+      string key = "schema " + absolutePath(filename);
+      vector<Stamp> stamps{stamp(filename)};
+      Entry entry;
+      if (find(key, stamps, entry)) {
+         return entry.schema;
       }
-      return 1.0*fraction/pow(10, numberOfDigits);
+      auto schema = make_shared<Schema>(filename);
+      insert(Entry{key, stamps, stamps[0].first, schema, nullptr});
+      return schema;
    }
 
-   bool compareDecimal(string input, string reference, int length, int precision, double epsilon) {
-      pair<uint64_t, uint64_t> inputDecimal;
-      try {
-         inputDecimal = parseDecimal(input, length, precision);
-      } catch (SchemaException& e) {
-         throw SchemaInputFileException(e.what());
-      }
-      pair<uint64_t, uint64_t> referenceDecimal;
-      try {
-         referenceDecimal = parseDecimal(reference, length, precision);
-      } catch (SchemaException& e) {
-         throw SchemaReferenceFileException(e.what());
+   // Returns null for references that are streamed or mapped through a window, the caller opens those itself
+   shared_ptr<Reference> getReference(const string& filename, const string& schemaFilename, Schema& schema, uint64_t windowSize) {
+      struct stat statistics;
+      if (util::CompressedStream::isCompressed(filename) || stat(filename.c_str(), &statistics) != 0 || !S_ISREG(statistics.st_mode) || (windowSize && uint64_t(statistics.st_size) > windowSize)) {
+         return nullptr;
       }
-      if (epsilon == 0.0) {
-         return inputDecimal.first == referenceDecimal.first && inputDecimal.second == referenceDecimal.second;
-      } else {
-         double inputDouble = inputDecimal.first + fractionToDouble(inputDecimal.second);
-         double referenceDouble = referenceDecimal.first + fractionToDouble(referenceDecimal.second);
-         double delta = fabs(inputDouble - referenceDouble)/referenceDouble*100.0;
-         return delta < epsilon;
+      // The compiled form depends on the schema as well
+      string compiledFilename = CompiledReference::filenameOf(filename);
+      string key = "reference " + absolutePath(filename) + " " + absolutePath(schemaFilename);
+      vector<Stamp> stamps{stamp(filename), stamp(schemaFilename), stamp(compiledFilename)};
+      Entry entry;
+      if (find(key, stamps, entry)) {
+         return entry.reference;
       }
+      auto reference = make_shared<Reference>(Reference{util::StructuredFile(filename), nullptr});
+      reference->compiled = CompiledReference::load(schema, reference->file);
+      insert(Entry{key, stamps, stamps[0].first + (reference->compiled ? stamps[2].first : 0), nullptr, reference});
+      return reference;
    }
+};
+//---------------------------------------------------------------------------
+class Verifier {
+private:
+   struct FileResult {
+      stringstream out;
+      stringstream err;
+      verify::Result report;
+      exception_ptr exception;
+      bool failed = false;
+      bool done = false;
+   };
+
+   // One input of the matrix against one reference
+   struct MatrixCell {
+      FileResult result;
+      bool missing = false;
+      double seconds = 0;
+   };
+
+   string inputPath;
+   // The input directories of --matrix, inputPath is empty then
+   vector<string> matrixInputPaths;
+   string referencePath;
+   string schemaPath;
+   double epsilon;
+   bool ignoreFirstLine;
+   bool trimStrings;
+   unsigned jobs;
+   unsigned chunks;
+   // Files that are verified at the same time, they share the cores for --chunks
+   unsigned concurrentFiles;
+   // Read input and reference on threads of their own
+   bool pipelined;
+   bool unordered;
+   size_t memoryBudget;
+   uint64_t windowSize;
+   // Inputs are followed while they are written until they did not change for as many seconds, zero does not follow
+   unsigned followSeconds;
+   // Empty, table or json
+   string statisticsFormat;
+   // Zero stops at the first error
+   unsigned maximumErrors;
+   bool digests;
+   // Percent of the chunks that are compared with --sample, zero compares everything
+   unsigned samplePercent;
+   bool stratified;
+   unsigned seed;
+   // Only compile the references instead of verifying
+   bool compileReferences;
+   // Schemas and references of earlier requests, only set in the server
+   ResultCache* cache;
+   // The cache of a matrix run outside of the server
+   unique_ptr<ResultCache> matrixCache;
+   // Relative paths are resolved against it if it is set, i.e. for requests of the server
+   string workingDirectory;
+   ostream& output;
+   ostream& errors;
 
-   bool compareDate(string input, string reference) {
-      return stol(input) == stol(reference);
+   void exitWithUsage(char *argv[]) {
+      errors << "Usage: " << argv[0] << " [--jobs N] [--unordered [--memory MB] | [--chunks N | --pipeline] [--max-errors N] [--digest | --sample PERCENT [--stratified] [--seed N]]] [--window MB] [--follow SECONDS] [--stats table|json] [--matrix INPUT,...] input reference schema [ignore first line] [epsilon] [trim strings]" << endl;
+      errors << "input, reference and schema are directories with one file per result, or the files of a single result (input - reads stdin)" << endl;
+      errors << "--matrix INPUT,INPUT,... reference schema [...] verifies several input directories against one reference and prints a result by input matrix" << endl;
+      errors << "epsilon is the relative tolerance of decimals in percent (0.0001 to 100), schema columns may declare their own as decimal(12,2) tolerance 0.01, 0.5% or 2 ulp" << endl;
+      errors << "--unordered compares input and reference as multisets of rows, exactly and therefore without epsilon or schema tolerances" << endl;
+      errors << "--pipeline reads input and reference on threads of their own while comparing, also for streamed results" << endl;
+      errors << "--max-errors compares the whole result and shows the first N errors and the number of errors per column" << endl;
+      errors << "--digest compares the input against digests of chunks of the reference, stored in reference.digest files" << endl;
+      errors << "--sample counts the records of mapped results and compares raw checksums of chunks, but only PERCENT of the differing chunks field by field, drawn at random or one per stratum with a fixed seed, and exits with 2 if it left differing chunks unverified" << endl;
+      errors << "--compile-reference reference schema writes reference.columns files, which are used instead of the text when present" << endl;
+      errors << "--window maps result files larger than MB through a sliding window instead of as a whole" << endl;
+      errors << "--follow verifies input files while they are written, also ones that are still to be created, until no process writes them any more or they did not change for SECONDS" << endl;
+      errors << "--stats prints bytes, rows, time and page faults per phase and the peak memory of the whole process so far, which covers all earlier and concurrent results, after every result" << endl;
+      errors << "--serve SOCKET [--cache MB] verifies the requests of --client SOCKET arguments and keeps schemas and references of up to MB cached" << endl;
+      throw VerificationAborted();
    }
 
-   bool compare(int attributeNumber, string input, string reference, double epsilon, bool trimStrings) {
-      Attribute attribute = attributes[attributeNumber];
-      if (attribute.null) {
-         if (input == "null" && reference == "null") {
-            return true;
-         }
-      } else {
-         if (input == "null") {
-            throw SchemaInputFileException("null not allowed");
-         }
-         if (reference == "null") {
-            throw SchemaReferenceFileException("null not allowed");
-         }
-      }
-      switch (attribute.type) {
-         case(Attribute::Type::Integer):
-         return compareInteger(input, reference);
-         case(Attribute::Type::BigInt):
-         return compareBigInt(input, reference);
-         case(Attribute::Type::Varchar):
-         return compareVarchar(input, reference, attribute.length, trimStrings);
-         case(Attribute::Type::Char):
-         return compareChar(input, reference, attribute.length, trimStrings);
-         case(Attribute::Type::Decimal):
-         return compareDecimal(input, reference, attribute.length, attribute.precision, epsilon);
-         case(Attribute::Type::Date):
-         return compareDate(input, reference);
+   unsigned parsePositiveNumber(int& argument, int argc, char *argv[]) {
+      if (argument + 1 == argc || atoi(argv[argument + 1]) < 1) {
+         exitWithUsage(argv);
       }
+      return atoi(argv[++argument]);
    }
 
-public:
-   Schema(string filename) {
-      util::MappedFile<char> file(filename);
-      numberOfAttributes = 0;
-      unique_ptr<stringstream> stream = unique_ptr<stringstream>(new stringstream);
-      ParserState state = ParserState::Name;
-      Attribute attribute;
-      auto position = file.begin();
-      while (position != file.end()) {
-         char character = *position;
-         switch (state) {
-            case (ParserState::Name):
-            if (character == ' ') {
-               attribute.name = stream->str();
-               stream = unique_ptr<stringstream>(new stringstream);
-               state = ParserState::Type;
-               ++position;
-               continue;
-            }
-            break;
-            case (ParserState::Type):
-            if (character == ' ' || character == '(' || character == '\n') {
-               if (stream->str() == "integer") {
-                  attribute.type = Attribute::Type::Integer;
-               } else if (stream->str() == "bigint") {
-                  attribute.type = Attribute::Type::BigInt;
-               } else if (stream->str() == "varchar") {
-                  attribute.type = Attribute::Type::Varchar;
-                  attribute.length = 1;
-               } else if (stream->str() == "char") {
-                  attribute.type = Attribute::Type::Char;
-                  attribute.length = 1;
-               } else if (stream->str() == "decimal") {
-                  attribute.type = Attribute::Type::Decimal;
-                  attribute.length = 4;
-                  attribute.precision = 2;
-               } else if (stream->str() == "date") {
-                  attribute.type = Attribute::Type::Date;
-               } else {
-                  throw SchemaException(string("unknown type ") + stream->str());
-               }
-               stream = unique_ptr<stringstream>(new stringstream);
-               if (character == '(') {
-                  state = ParserState::TypeLength;
-               } else if (character == ' ') {
-                  state = ParserState::NullInfo;
-               } else if (character == '\n') {
-                  state = ParserState::NullInfo;
-                  continue;
-               }
-               ++position;
-               continue;
-            }
-            break;
-            case (ParserState::TypeLength):
-            if (character == ' ' || character == ',' || character == '\n') {
-               if (attribute.type == Attribute::Type::Integer || attribute.type == Attribute::Type::BigInt || attribute.type == Attribute::Type::Date) {
-                  throw SchemaException("type cannot have a length");
-               }
-               attribute.length = stoi(stream->str());
-               stream = unique_ptr<stringstream>(new stringstream);
-               if (character == ',') {
-                  state = ParserState::TypePrecision;
-               } else if (character == ' ') {
-                  state = ParserState::NullInfo;
-               } else if (character == '\n') {
-                  state = ParserState::NullInfo;
-                  continue;
-               }
-               ++position;
-               continue;
-            }
-            break;
-            case (ParserState::TypePrecision):
-            if (character == ' ' || character == '\n') {
-               if (attribute.type != Attribute::Type::Decimal) {
-                  throw SchemaException("type cannot have a precision");
-               }
-               attribute.precision = stoi(stream->str());
-               stream = unique_ptr<stringstream>(new stringstream);
-               state = ParserState::NullInfo;
-               if (character == '\n') {
-                  continue;
-               }
-               ++position;
-               continue;
+   void parseCommandLineArguments(int argc, char *argv[]) {
+      jobs = 1;
+      chunks = 1;
+      concurrentFiles = 1;
+      pipelined = false;
+      unordered = false;
+      memoryBudget = size_t(1024) << 20;
+      windowSize = 0;
+      followSeconds = 0;
+      statisticsFormat = "";
+      maximumErrors = 0;
+      digests = false;
+      samplePercent = 0;
+      stratified = false;
+      seed = 1;
+      compileReferences = false;
+      matrixInputPaths.clear();
+      vector<char*> arguments{argv[0]};
+      for (int argument = 1; argument != argc; ++argument) {
+         string option = argv[argument];
+         if (option == "--jobs") {
+            jobs = parsePositiveNumber(argument, argc, argv);
+         } else if (option == "--chunks") {
+            chunks = parsePositiveNumber(argument, argc, argv);
+         } else if (option == "--pipeline") {
+            pipelined = true;
+         } else if (option == "--unordered") {
+            unordered = true;
+         } else if (option == "--memory") {
+            memoryBudget = size_t(parsePositiveNumber(argument, argc, argv)) << 20;
+         } else if (option == "--max-errors") {
+            maximumErrors = parsePositiveNumber(argument, argc, argv);
+         } else if (option == "--digest") {
+            digests = true;
+         } else if (option == "--sample") {
+            samplePercent = parsePositiveNumber(argument, argc, argv);
+            if (samplePercent > 100) {
+               exitWithUsage(argv);
             }
-            break;
-            case (ParserState::NullInfo):
-            if (character == '\n') {
-               if (stream->str() == "not null") {
-                  attribute.null = false;
-               } else if (stream->str() == "null") {
-                  attribute.null = true;
-               } else if (stream->str() == "") {
-                  attribute.null = true;
-               } else {
-                  throw SchemaException("invalid null info");
+         } else if (option == "--stratified") {
+            stratified = true;
+         } else if (option == "--seed") {
+            seed = parsePositiveNumber(argument, argc, argv);
+         } else if (option == "--compile-reference") {
+            compileReferences = true;
+         } else if (option == "--matrix" && argument + 1 != argc) {
+            stringstream list(argv[++argument]);
+            string path;
+            while (getline(list, path, ',')) {
+               if (!path.empty()) {
+                  matrixInputPaths.push_back(path);
                }
-               stream = unique_ptr<stringstream>(new stringstream);
-               state = ParserState::EndOfAttribute;
-               continue;
             }
-            break;
-            case (ParserState::EndOfAttribute):
-            if (character == '\n') {
-               attributes.push_back(attribute);
-               attribute = Attribute();
-               ++numberOfAttributes;
-               state = ParserState::Name;
-               ++position;
-               continue;
-            } else {
-               throw SchemaException("missing newline at end of attribute");
+            if (matrixInputPaths.empty()) {
+               exitWithUsage(argv);
             }
-            break;
-         }
-         *stream << character;
-         ++position;
-      }
-      // Finish last attribute
-      switch (state) {
-         case (ParserState::Type):
-         if (stream->str() == "integer") {
-            attribute.type = Attribute::Type::Integer;
-         } else if (stream->str() == "bigint") {
-            attribute.type = Attribute::Type::BigInt;
-         } else if (stream->str() == "varchar") {
-            attribute.type = Attribute::Type::Varchar;
-            attribute.length = 1;
-         } else if (stream->str() == "char") {
-            attribute.type = Attribute::Type::Char;
-            attribute.length = 1;
-         } else if (stream->str() == "decimal") {
-            attribute.type = Attribute::Type::Decimal;
-            attribute.length = 4;
-            attribute.precision = 2;
-         } else if (stream->str() == "date") {
-            attribute.type = Attribute::Type::Date;
+         } else if (option == "--window") {
+            windowSize = uint64_t(parsePositiveNumber(argument, argc, argv)) << 20;
+         } else if (option == "--follow") {
+            followSeconds = parsePositiveNumber(argument, argc, argv);
+         } else if (option == "--stats" && argument + 1 != argc && (string(argv[argument + 1]) == "table" || string(argv[argument + 1]) == "json")) {
+            statisticsFormat = argv[++argument];
+         } else if (option.compare(0, 2, "--") == 0) {
+            exitWithUsage(argv);
          } else {
-            throw SchemaException(string("unknown type ") + stream->str());
-         }
-         break;
-         case (ParserState::TypeLength):
-         if (attribute.type == Attribute::Type::Integer || attribute.type == Attribute::Type::BigInt || attribute.type == Attribute::Type::Date) {
-            throw SchemaException("type cannot have a length");
-         }
-         attribute.length = stoi(stream->str());
-         break;
-         case (ParserState::TypePrecision):
-         if (attribute.type != Attribute::Type::Decimal) {
-            throw SchemaException("type cannot have a precision");
-         }
-         attribute.precision = stoi(stream->str());
-         break;
-         case (ParserState::NullInfo):
-         if (stream->str() == "not null") {
-            attribute.null = false;
-         } else if (stream->str() == "null") {
-            attribute.null = true;
-         } else if (stream->str() == "") {
-            attribute.null = true;
-         } else {
-            throw SchemaException("invalid null info");
+            arguments.push_back(argv[argument]);
          }
-         default:
-         break;
       }
-      if (state != ParserState::Name) {
-         attributes.push_back(attribute);
-         ++numberOfAttributes;
+      argc = arguments.size();
+      argv = arguments.data();
+      for (auto& path : matrixInputPaths) {
+         path = resolvePath(path);
       }
-   }
-
-   void compare(util::StructuredFile& inputFile, util::StructuredFile& referenceFile, double epsilon, bool trimStrings) {
-      bool inputFinished = false;
-      bool referenceFinished = false;
-      while (true) {
-         for (int field = 0; field != numberOfAttributes; ++field) {
-            string input;
-            try {
-               input = inputFile.getNextField();
-            } catch (util::EndOfFileException& e) {
-               inputFinished = true;
-            } catch (util::EndOfRecordException& e) {
-               cout << numberOfAttributes << endl;
-               throwError(inputFile, "too few fields");
-            }
-            string reference;
-            try {
-               reference = referenceFile.getNextField();
-            } catch (util::EndOfFileException& e) {
-               referenceFinished = true;
-            } catch (util::EndOfRecordException& e) {
-               throwError(referenceFile, "too few fields");
-            }
-            if (inputFinished && referenceFinished) {
-               return;
-            }
-            if (inputFinished) {
-               throwError(inputFile, "too few results");
-            }
-            if (referenceFinished) {
-               try {
-                  // trim empty lines from end of input file
-                  while (input.size() == 0) {
-                     try {
-                        input = inputFile.getNextField();
-                     } catch (util::EndOfRecordException& e) {
-                        inputFile.getNextRecord();
-                     }
-                  }
-                  throwError(inputFile, "too many results");
-               } catch (util::EndOfFileException& e) {
-                  return;
-               }
-            }
-            try {
-               if (!compare(field, input, reference, epsilon, trimStrings)) {
-                  throwError(inputFile, string("expected ") + reference + string(" got ") + input);
-               }
-            } catch(SchemaInputFileException& e) {
-               throwError(inputFile, e.what(), field);
-            } catch(SchemaReferenceFileException& e) {
-               throwError(referenceFile, e.what(), field);
-            }
+      if (compileReferences) {
+         if (argc != 3) {
+            exitWithUsage(argv);
          }
-         inputFile.getNextRecord();
-         referenceFile.getNextRecord();
+         referencePath = resolvePath(argv[1]);
+         schemaPath = resolvePath(argv[2]);
+         exitIfPathIsAbsent(referencePath);
+         exitIfPathIsAbsent(schemaPath);
+         return;
       }
-   }
-};
-//---------------------------------------------------------------------------
-class Verifier {
-private:
-   string inputPath;
-   string referencePath;
-   string schemaPath;
-   double epsilon;
-   bool ignoreFirstLine;
-   bool trimStrings;
-
-   void parseCommandLineArguments(int argc, char *argv[]) {
-      if (argc < 4 || argc > 7) {
-         cerr << "Usage: " << argv[0] << " input reference schema [ignore first line] [epsilon] [trim strings]" << endl;
-         exit(EXIT_FAILURE);
+      // The inputs of --matrix are not positional
+      int reference = matrixInputPaths.empty() ? 2 : 1;
+      if (argc < reference + 2 || argc > reference + 5 || (unordered && (chunks > 1 || pipelined || maximumErrors || digests || samplePercent)) || (chunks > 1 && pipelined) || (digests && samplePercent)) {
+         exitWithUsage(argv);
       }
-      inputPath = argv[1];
-      referencePath = argv[2];
-      schemaPath = argv[3];
+      inputPath = reference == 2 ? resolvePath(argv[1]) : "";
+      referencePath = resolvePath(argv[reference]);
+      schemaPath = resolvePath(argv[reference + 1]);
       ignoreFirstLine = true;
-      if (argc > 4) {
-         ignoreFirstLine = strcmp(argv[4], "true") == 0;
+      if (argc > reference + 2) {
+         ignoreFirstLine = strcmp(argv[reference + 2], "true") == 0;
       }
       epsilon = 0.0;
-      if (argc > 5) {
-         epsilon = atof(argv[5]);
+      if (argc > reference + 3) {
+         epsilon = atof(argv[reference + 3]);
+      }
+      if (unordered && epsilon != 0.0) {
+         exitWithUsage(argv);
+      }
+      if (!Tolerance::isValidRelative(epsilon)) {
+         errors << "epsilon " << argv[reference + 3] << " is neither 0 nor between 0.0001 and 100 percent" << endl;
+         throw VerificationAborted();
       }
       trimStrings = false;
-      if (argc > 6) {
-         trimStrings = strcmp(argv[6], "true") == 0;
+      if (argc > reference + 4) {
+         trimStrings = strcmp(argv[reference + 4], "true") == 0;
+      }
+      // Followed inputs may be created later
+      if (!inputPath.empty() && inputPath != "-" && !followSeconds) {
+         exitIfPathIsAbsent(inputPath);
+      }
+      for (auto& path : matrixInputPaths) {
+         exitIfPathIsAbsent(path);
       }
-      exitIfPathIsAbsent(inputPath);
       exitIfPathIsAbsent(referencePath);
       exitIfPathIsAbsent(schemaPath);
    }
 
+   string resolvePath(string path) {
+      return workingDirectory.empty() || path.empty() || path[0] == '/' || path == "-" ? path : concatenatePath(workingDirectory, path);
+   }
+
    void exitIfPathIsAbsent(string path) {
       if (access(path.c_str(), F_OK) == -1) {
-         cerr << path << ": no such file or directory" << endl;
-         exit(EXIT_FAILURE);
+         errors << path << ": no such file or directory" << endl;
+         throw VerificationAborted(path + ": no such file or directory");
       }
    }
 
@@ -495,71 +389,792 @@ private:
       if ((directory = opendir(path.c_str())) != nullptr) {
          struct dirent *entry = readdir(directory);
          while (entry != nullptr) {
-            if (entry->d_type == DT_REG && (includeInvisible || entry->d_name[0] != '.')) {
-               result.push_back(entry->d_name);
+            // FIFOs are streamed, so a query client can write its result directly into the input directory
+            if ((entry->d_type == DT_REG || entry->d_type == DT_FIFO) && (includeInvisible || entry->d_name[0] != '.')) {
+               // Compressed results are listed under the name of the uncompressed file
+               string name = entry->d_name;
+               if (util::CompressedStream::isCompressed(name)) {
+                  name.erase(name.find_last_of('.'));
+               }
+               // Digests and compiled forms of references are no results
+               if (!util::CompressedStream::hasSuffix(name, ".digest") && !util::CompressedStream::hasSuffix(name, ".columns")) {
+                  result.push_back(name);
+               }
             }
             entry = readdir(directory);
          }
          closedir(directory);
       } else {
-         cerr << path << ": could not open directory" << endl;
-         exit(EXIT_FAILURE);
+         errors << path << ": could not open directory" << endl;
+         throw VerificationAborted();
       }
+      // Directory order depends on the file system, numbers are ordered by value so that 2.txt precedes 10.txt
+      sort(result.begin(), result.end(), naturalLess);
+      result.erase(unique(result.begin(), result.end()), result.end());
       return result;
    }
 
+   static bool naturalLess(const string& left, const string& right) {
+      size_t l = 0, r = 0;
+      while (l != left.size() && r != right.size()) {
+         if (isdigit(left[l]) && isdigit(right[r])) {
+            size_t lEnd = left.find_first_not_of("0123456789", l);
+            size_t rEnd = right.find_first_not_of("0123456789", r);
+            lEnd = lEnd == string::npos ? left.size() : lEnd;
+            rEnd = rEnd == string::npos ? right.size() : rEnd;
+            string_view lNumber = ltrimZeros(string_view(left).substr(l, lEnd - l));
+            string_view rNumber = ltrimZeros(string_view(right).substr(r, rEnd - r));
+            if (lNumber.size() != rNumber.size()) {
+               return lNumber.size() < rNumber.size();
+            }
+            if (lNumber != rNumber) {
+               return lNumber < rNumber;
+            }
+            l = lEnd;
+            r = rEnd;
+         } else {
+            if (left[l] != right[r]) {
+               return left[l] < right[r];
+            }
+            ++l;
+            ++r;
+         }
+      }
+      return left.size() - l < right.size() - r || (left.size() - l == right.size() - r && left < right);
+   }
+
+   static string_view ltrimZeros(string_view number) {
+      while (number.size() > 1 && number.front() == '0') {
+         number.remove_prefix(1);
+      }
+      return number;
+   }
+
    string concatenatePath(string prefix, string suffix) {
       return prefix + string("/") + suffix;
    }
 
-   void verifyResult(string filename) {
-      cout << filename << endl;
-      string schemaFilename = concatenatePath(schemaPath, filename);
+   // Falls back to a compressed N.txt.zst or N.txt.gz if N.txt does not exist
+   string findResultFile(string filename) {
+      if (access(filename.c_str(), F_OK) == 0) {
+         return filename;
+      }
+      for (string suffix : {".zst", ".gz"}) {
+         if (access((filename + suffix).c_str(), F_OK) == 0) {
+            return filename + suffix;
+         }
+      }
+      return filename;
+   }
+
+   off_t fileSize(string filename) {
+      struct stat statistics;
+      return stat(filename.c_str(), &statistics) == 0 ? statistics.st_size : 0;
+   }
+
+   void exitIfResultFilesAreAbsent(string filename) {
+      exitIfPathIsAbsent(concatenatePath(schemaPath, filename));
+      exitIfPathIsAbsent(findResultFile(concatenatePath(inputPath, filename)));
+      exitIfPathIsAbsent(findResultFile(concatenatePath(referencePath, filename)));
+   }
+
+   bool isRegularFile(string path) {
+      struct stat statistics;
+      return stat(path.c_str(), &statistics) == 0 && S_ISREG(statistics.st_mode);
+   }
+
+   bool isDirectory(string path) {
+      struct stat statistics;
+      return stat(path.c_str(), &statistics) == 0 && S_ISDIR(statistics.st_mode);
+   }
+
+   // The file for a single result: path itself, or the file with the result's name if path is a directory
+   string resultPath(string path, string filename) {
+      return isDirectory(path) ? concatenatePath(path, filename) : path;
+   }
+
+   bool verifyResult(string filename, ostream& out, ostream& err, verify::Result& report) {
+      return verifyResult(filename, concatenatePath(inputPath, filename), concatenatePath(referencePath, filename), concatenatePath(schemaPath, filename), out, err, report);
+   }
+
+   void printStatistics(string filename, util::Statistics& statistics, ostream& out) {
+      // Of the process, not of this result alone
+      uint64_t peakResidentSetSize = util::Statistics::peakResidentSetSize();
+      out << fixed << setprecision(6);
+      if (statisticsFormat == "json") {
+         out << "{\"file\":\"" << util::escapeJson(filename) << "\",\"bytes\":" << statistics.bytes << ",\"rows\":" << statistics.rows << ",\"process_peak_rss_kib\":" << peakResidentSetSize << ",\"phases\":{";
+         bool first = true;
+         for (auto& phase : statistics.getPhases()) {
+            out << (first ? "" : ",") << "\"" << phase.name << "\":{\"wall\":" << phase.wall << ",\"cpu\":" << phase.cpu << ",\"minor_faults\":" << phase.minorFaults << ",\"major_faults\":" << phase.majorFaults << "}";
+            first = false;
+         }
+         out << "}}" << endl;
+      } else {
+         out << "statistics of " << filename << ": " << statistics.bytes << " bytes, " << statistics.rows << " rows, process peak rss " << peakResidentSetSize << " KiB" << endl;
+         out << "   " << left << setw(10) << "phase" << right << setw(12) << "wall s" << setw(12) << "cpu s" << setw(14) << "minor faults" << setw(14) << "major faults" << endl;
+         for (auto& phase : statistics.getPhases()) {
+            out << "   " << left << setw(10) << phase.name << right << setw(12) << phase.wall << setw(12) << phase.cpu << setw(14) << phase.minorFaults << setw(14) << phase.majorFaults << endl;
+         }
+      }
+      out.copyfmt(ios(nullptr));
+   }
+
+   void printSample(const SampledComparison& comparison, ostream& out) {
+      if (comparison.isComplete()) {
+         out << "streamed results are compared in full" << endl;
+         return;
+      }
+      uint64_t records = max<uint64_t>(comparison.getRecords(), 1);
+      out << fixed << setprecision(2) << "verified " << 100.0*comparison.getVerifiedRecords()/records << "% of " << comparison.getRecords() << " records in full, " << 100.0*comparison.getIdenticalRecords()/records << "% byte for byte identical to the reference" << endl;
+      out.copyfmt(ios(nullptr));
+      if (comparison.getUnverifiedChunks()) {
+         out << "unverified: " << comparison.getUnverifiedChunks() << " differing chunks with " << comparison.getUnverifiedRecords() << " records were not compared" << endl;
+         unverified = true;
+      }
+   }
+
+   // Results of schemas with sort keys are compared run by run of equal sort keys, which the faster comparisons in file
+   // order cannot do. Warns about the options and compiled references that are not used therefore.
+   void warnAboutSortKeys(Schema& schema, util::StructuredFile& referenceFile, ostream& err) {
+      vector<string> ignored;
+      if (chunks > 1) {
+         ignored.push_back("--chunks");
+      }
+      if (pipelined) {
+         ignored.push_back("--pipeline");
+      }
+      if (digests) {
+         ignored.push_back("--digest");
+      }
+      if (samplePercent) {
+         ignored.push_back("--sample");
+      }
+      if (CompiledReference::load(schema, referenceFile)) {
+         ignored.push_back(CompiledReference::filenameOf(referenceFile.getFilename()));
+      }
+      if (!ignored.empty()) {
+         err << "warning: the schema has sort keys, ignoring";
+         for (size_t option = 0; option != ignored.size(); ++option) {
+            err << (option ? ", " : " ") << ignored[option];
+         }
+         err << endl;
+      }
+   }
+
+   // Returns true if the result differs from the reference. Errors that end the verification, e.g. files that cannot be
+   // read, are added to the report as well before they are rethrown.
+   bool verifyResult(string filename, string inputFilename, string referenceFilename, string schemaFilename, ostream& out, ostream& err, verify::Result& report) {
+      try {
+         return compareResult(filename, inputFilename, referenceFilename, schemaFilename, out, err, report);
+      } catch (util::FileError& e) {
+         report.errors.push_back(verify::Error{verify::Error::Kind::File, e.what()});
+         throw;
+      } catch (VerificationAborted& e) {
+         report.errors.push_back(verify::Error{verify::Error::Kind::File, e.what()});
+         throw;
+      }
+   }
+
+   bool compareResult(string filename, string inputFilename, string referenceFilename, string schemaFilename, ostream& out, ostream& err, verify::Result& report) {
+      out << filename << endl;
+      util::Statistics fileStatistics;
+      util::Statistics* statistics = statisticsFormat.empty() ? nullptr : &fileStatistics;
       exitIfPathIsAbsent(schemaFilename);
-      Schema schema(schemaFilename);
-      string inputFilename = concatenatePath(inputPath, filename);
-      exitIfPathIsAbsent(inputFilename);
-      util::StructuredFile inputFile(inputFilename);
+      shared_ptr<Schema> cachedSchema;
+      try {
+         cachedSchema = util::Statistics::measure(statistics, "schema", [&]() { return cache ? cache->getSchema(schemaFilename) : make_shared<Schema>(schemaFilename); });
+      } catch (util::FileError&) {
+         throw;
+      } catch (exception& e) {
+         // Includes malformed lengths, precisions and tolerances
+         string message = schemaFilename + ": " + e.what();
+         err << message << endl;
+         report.errors.push_back(verify::Error{verify::Error::Kind::Schema, message});
+         return true;
+      }
+      Schema& schema = *cachedSchema;
+      util::Statistics::Timer timer(statistics, "map");
+      if (inputFilename != "-") {
+         inputFilename = findResultFile(inputFilename);
+         if (followSeconds) {
+            util::FollowStream::waitForCreation(inputFilename, followSeconds*1000);
+         }
+         exitIfPathIsAbsent(inputFilename);
+      }
+      // Compressed files and pipes are read as they are written anyway
+      bool followed = followSeconds && inputFilename != "-" && !util::CompressedStream::isCompressed(inputFilename) && isRegularFile(inputFilename);
+      util::StructuredFile inputFile = followed ? util::StructuredFile(inputFilename, make_shared<util::FollowStream>(inputFilename, followSeconds*1000)) : util::StructuredFile(inputFilename, windowSize);
       inputFile.ignoreFirstLine = ignoreFirstLine;
-      string referenceFilename = concatenatePath(referencePath, filename);
+      referenceFilename = findResultFile(referenceFilename);
       exitIfPathIsAbsent(referenceFilename);
-      util::StructuredFile referenceFile(referenceFilename);
+      shared_ptr<ResultCache::Reference> cachedReference = cache ? cache->getReference(referenceFilename, schemaFilename, schema, windowSize) : nullptr;
+      util::StructuredFile referenceFile = cachedReference ? cachedReference->file : util::StructuredFile(referenceFilename, windowSize);
+      timer.stop();
+      fileStatistics.bytes = (inputFilename == "-" ? 0 : fileSize(inputFilename)) + fileSize(referenceFilename);
+      bool failed = false;
+      MismatchCollector collector(maximumErrors, schema.getNumberOfAttributes());
+      MismatchCollector* mismatches = maximumErrors ? &collector : nullptr;
+      shared_ptr<CompiledReference> compiled;
+      optional<int> stoppedAtField;
+      if (unordered && schema.hasTolerances()) {
+         string message = schemaFilename + ": --unordered compares rows exactly and cannot apply the tolerances of the schema";
+         err << message << endl;
+         report.errors.push_back(verify::Error{verify::Error::Kind::Options, message});
+         return true;
+      }
       try {
-         schema.compare(inputFile, referenceFile, epsilon, trimStrings);
+         if (unordered) {
+            UnorderedComparison(schema, trimStrings, memoryBudget, statistics).compare(inputFile, referenceFile);
+         } else if (!schema.getSortKeys().empty()) {
+            warnAboutSortKeys(schema, referenceFile, err);
+            TieGroupComparison(schema, epsilon, trimStrings, statistics, mismatches).compare(inputFile, referenceFile);
+         } else if (samplePercent) {
+            SampledComparison comparison(schema, epsilon, trimStrings, samplePercent/100.0, stratified, seed, statistics, mismatches);
+            comparison.compare(inputFile, referenceFile);
+            printSample(comparison, out);
+         } else if (digests) {
+            DigestComparison(schema, epsilon, trimStrings, statistics, mismatches).compare(inputFile, referenceFile);
+         } else if ((compiled = cachedReference ? cachedReference->compiled : CompiledReference::load(schema, referenceFile))) {
+            ComparisonPlan(schema, epsilon, trimStrings, statistics, mismatches).compare(inputFile, referenceFile, compiled.get());
+         } else if (chunks > 1) {
+            schema.compareInChunks(inputFile, referenceFile, epsilon, trimStrings, chunks, max(thread::hardware_concurrency()/concurrentFiles, 1u), statistics, mismatches);
+         } else if (pipelined) {
+            PipelinedComparison(schema, epsilon, trimStrings, statistics, mismatches).compare(inputFile, referenceFile);
+         } else {
+            schema.compare(inputFile, referenceFile, epsilon, trimStrings, statistics, mismatches);
+         }
       } catch (SchemaException& e) {
+         err << e.what() << endl;
+         err << "skipping file after first error" << endl;
          failed = true;
-         cerr << e.what() << endl;
-         cerr << "skipping file after first error" << endl;
+         report.errors.push_back(verify::Error{verify::Error::Kind::Mismatch, e.what(), e.line, e.field});
+         stoppedAtField = e.field;
+      }
+      if (collector.getCount()) {
+         collector.print(schema.getAttributeNames(), err);
+         failed = true;
+      }
+      for (auto& mismatch : collector.getMismatches()) {
+         report.errors.push_back(verify::Error{verify::Error::Kind::Mismatch, mismatch.message, mismatch.line, mismatch.field});
+      }
+      report.mismatchesPerColumn = collector.getFieldCounts();
+      report.numberOfMismatches = collector.getCount();
+      // The error that stopped the comparison is not part of the collector
+      if (stoppedAtField) {
+         ++report.mismatchesPerColumn[*stoppedAtField < 0 ? report.mismatchesPerColumn.size() - 1 : *stoppedAtField];
+         ++report.numberOfMismatches;
+      }
+      if (statistics) {
+         printStatistics(filename, *statistics, out);
+      }
+      return failed;
+   }
+
+   // Output is buffered per file and printed in file order as soon as all preceding files are done
+   void verifyInParallel(const vector<string>& files) {
+      for (auto& file : files) {
+         exitIfResultFilesAreAbsent(file);
+      }
+      vector<FileResult> results(files.size());
+      mutex resultMutex;
+      condition_variable resultDone;
+      // Largest inputs first so that the slowest file does not run alone at the end
+      vector<size_t> schedule(files.size());
+      vector<off_t> sizes(files.size());
+      for (size_t file = 0; file != files.size(); ++file) {
+         schedule[file] = file;
+         sizes[file] = fileSize(findResultFile(concatenatePath(inputPath, files[file]))) + fileSize(findResultFile(concatenatePath(referencePath, files[file])));
+      }
+      stable_sort(schedule.begin(), schedule.end(), [&](size_t left, size_t right) { return sizes[left] > sizes[right]; });
+      concurrentFiles = min<size_t>(jobs, files.size());
+      util::ThreadPool pool(concurrentFiles);
+      for (size_t file : schedule) {
+         pool.schedule([&, file]() {
+            FileResult& result = results[file];
+            try {
+               result.failed = verifyResult(files[file], result.out, result.err, result.report);
+            } catch (...) {
+               result.exception = current_exception();
+            }
+            lock_guard<mutex> lock(resultMutex);
+            result.done = true;
+            resultDone.notify_all();
+         });
+      }
+      for (auto& result : results) {
+         {
+            unique_lock<mutex> lock(resultMutex);
+            resultDone.wait(lock, [&]() { return result.done; });
+         }
+         output << result.out.rdbuf() << flush;
+         if (result.err.rdbuf()->in_avail()) {
+            errors << result.err.rdbuf() << flush;
+         }
+         reports.emplace_back(files[&result - results.data()], move(result.report));
+         if (result.exception) {
+            rethrow_exception(result.exception);
+         }
+         failed |= result.failed;
+      }
+   }
+
+   void printMatrix(const vector<string>& files, const vector<MatrixCell>& cells) {
+      size_t nameWidth = 8;
+      for (auto& file : files) {
+         nameWidth = max(nameWidth, file.size() + 2);
+      }
+      vector<size_t> widths;
+      output << left << setw(nameWidth) << "result";
+      for (auto& path : matrixInputPaths) {
+         widths.push_back(max<size_t>(path.size(), 16) + 2);
+         output << setw(widths.back()) << path;
+      }
+      output << endl;
+      for (size_t file = 0; file != files.size(); ++file) {
+         output << setw(nameWidth) << files[file];
+         for (size_t input = 0; input != matrixInputPaths.size(); ++input) {
+            const MatrixCell& cell = cells[file*matrixInputPaths.size() + input];
+            stringstream text;
+            if (cell.missing) {
+               text << "missing";
+            } else {
+               text << (cell.result.failed ? "failed " : "ok ") << fixed << setprecision(3) << cell.seconds << "s";
+            }
+            output << setw(widths[input]) << text.str();
+         }
+         output << endl;
+      }
+      output.copyfmt(ios(nullptr));
+   }
+
+   // Verifies every result of the reference directory for each input directory of --matrix. Schemas and references
+   // are loaded once into the cache before the comparisons start, so that all inputs share them. Comparisons run in
+   // parallel with --jobs, those of the same result next to each other.
+   void verifyMatrix() {
+      for (auto& path : matrixInputPaths) {
+         if (!isDirectory(path)) {
+            errors << path << ": --matrix needs input directories" << endl;
+            throw VerificationAborted();
+         }
+      }
+      if (!isDirectory(referencePath) || !isDirectory(schemaPath)) {
+         errors << "--matrix needs reference and schema directories" << endl;
+         throw VerificationAborted();
+      }
+      if (!cache) {
+         matrixCache = make_unique<ResultCache>(numeric_limits<size_t>::max());
+         cache = matrixCache.get();
+      }
+      auto files = getFilesInDirectory(referencePath);
+      if (files.size() == 0) {
+         errors << "no reference files" << endl;
+      }
+      for (auto& file : files) {
+         string schemaFilename = concatenatePath(schemaPath, file);
+         exitIfPathIsAbsent(schemaFilename);
+         shared_ptr<Schema> schema = cache->getSchema(schemaFilename);
+         cache->getReference(findResultFile(concatenatePath(referencePath, file)), schemaFilename, *schema, windowSize);
+      }
+      vector<MatrixCell> cells(files.size()*matrixInputPaths.size());
+      mutex resultMutex;
+      condition_variable resultDone;
+      concurrentFiles = max<size_t>(min<size_t>(jobs, cells.size()), 1);
+      util::ThreadPool pool(concurrentFiles);
+      for (size_t file = 0; file != files.size(); ++file) {
+         for (size_t input = 0; input != matrixInputPaths.size(); ++input) {
+            MatrixCell& cell = cells[file*matrixInputPaths.size() + input];
+            string inputFilename = findResultFile(concatenatePath(matrixInputPaths[input], files[file]));
+            if (access(inputFilename.c_str(), F_OK) == -1) {
+               cell.missing = true;
+               cell.result.done = true;
+               continue;
+            }
+            pool.schedule([&, file, input]() {
+               MatrixCell& cell = cells[file*matrixInputPaths.size() + input];
+               FileResult& result = cell.result;
+               auto begin = chrono::steady_clock::now();
+               try {
+                  string& path = matrixInputPaths[input];
+                  result.failed = verifyResult(concatenatePath(path, files[file]), concatenatePath(path, files[file]), concatenatePath(referencePath, files[file]), concatenatePath(schemaPath, files[file]), result.out, result.err, result.report);
+               } catch (...) {
+                  result.exception = current_exception();
+               }
+               cell.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+               lock_guard<mutex> lock(resultMutex);
+               result.done = true;
+               resultDone.notify_all();
+            });
+         }
+      }
+      for (size_t index = 0; index != cells.size(); ++index) {
+         MatrixCell& cell = cells[index];
+         {
+            unique_lock<mutex> lock(resultMutex);
+            resultDone.wait(lock, [&]() { return cell.result.done; });
+         }
+         string filename = concatenatePath(matrixInputPaths[index % matrixInputPaths.size()], files[index/matrixInputPaths.size()]);
+         if (cell.missing) {
+            errors << filename << ": no such file or directory" << endl;
+            verify::Result report;
+            report.errors.push_back(verify::Error{verify::Error::Kind::File, filename + ": no such file or directory"});
+            reports.emplace_back(filename, move(report));
+            failed = true;
+            continue;
+         }
+         output << cell.result.out.rdbuf() << flush;
+         if (cell.result.err.rdbuf()->in_avail()) {
+            errors << cell.result.err.rdbuf() << flush;
+         }
+         reports.emplace_back(filename, move(cell.result.report));
+         if (cell.result.exception) {
+            rethrow_exception(cell.result.exception);
+         }
+         failed |= cell.result.failed;
       }
+      printMatrix(files, cells);
    }
 
 public:
    bool failed;
+   // Set from the threads of --jobs if --sample did not compare all differing chunks
+   atomic<bool> unverified;
+   // Structured outcome of every verified file, in the order of the output
+   vector<pair<string, verify::Result>> reports;
 
-   Verifier(int argc, char *argv[]) : failed(false) {
+   Verifier(int argc, char *argv[], ResultCache* cache = nullptr, ostream& output = cout, ostream& errors = cerr, string workingDirectory = "") : cache(cache), workingDirectory(workingDirectory), output(output), errors(errors), failed(false), unverified(false) {
       parseCommandLineArguments(argc, argv);
    }
 
+   void compileReference(string filename) {
+      string referenceFilename = findResultFile(resultPath(referencePath, filename));
+      string schemaFilename = resultPath(schemaPath, filename);
+      exitIfPathIsAbsent(referenceFilename);
+      exitIfPathIsAbsent(schemaFilename);
+      Schema schema(schemaFilename);
+      util::StructuredFile referenceFile(referenceFilename);
+      if (referenceFile.isStreamed()) {
+         errors << referenceFilename << ": compressed and streamed references cannot be compiled" << endl;
+         failed = true;
+         return;
+      }
+      uint64_t records = CompiledReference::compile(schema, referenceFile);
+      output << CompiledReference::filenameOf(referenceFilename) << ": " << records << " records" << endl;
+      if (!schema.getSortKeys().empty()) {
+         errors << "warning: " << schemaFilename << " has sort keys, the compiled reference is not used for it" << endl;
+      }
+   }
+
    void verify() {
+      if (compileReferences) {
+         if (isDirectory(referencePath)) {
+            for (auto& file : getFilesInDirectory(referencePath)) {
+               compileReference(file);
+            }
+         } else {
+            compileReference(referencePath.substr(referencePath.find_last_of('/') + 1));
+         }
+         return;
+      }
+      if (!matrixInputPaths.empty()) {
+         verifyMatrix();
+         return;
+      }
+      // A single result, e.g. "-" to stream it from stdin
+      if (!isDirectory(inputPath)) {
+         string filename = inputPath == "-" ? "stdin" : inputPath.substr(inputPath.find_last_of('/') + 1);
+         if (util::CompressedStream::isCompressed(filename)) {
+            filename.erase(filename.find_last_of('.'));
+         }
+         reports.emplace_back(filename, verify::Result());
+         failed |= verifyResult(filename, inputPath, resultPath(referencePath, filename), resultPath(schemaPath, filename), output, errors, reports.back().second);
+         return;
+      }
       auto files = getFilesInDirectory(inputPath);
       if (files.size() == 0) {
-         cerr << "no input files" << endl;
+         errors << "no input files" << endl;
+      }
+      if (jobs > 1 && files.size() > 1) {
+         verifyInParallel(files);
+         return;
       }
       for (auto file : files) {
-         verifyResult(file);
+         reports.emplace_back(file, verify::Result());
+         failed |= verifyResult(file, output, errors, reports.back().second);
+      }
+   }
+};
+//---------------------------------------------------------------------------
+// Verifies results for clients on a Unix domain socket and keeps schemas and references cached between requests. A
+// request is the working directory of the client followed by the arguments of verify, one per line and terminated by
+// an empty line. Relative paths of the arguments are resolved against that directory. The response is the line
+// {"failed":true|false,"unverified":true|false,"output":"...","errors":"...","results":[...]} with the printed output and errors and, per
+// verified file, {"file":"...","errors":[{"kind":"mismatch|schema|file|options","message":"...","line":7,"field":2}],
+// "mismatches":1,"mismatches_per_column":[0,0,1,0,0]}. Up to maximumConnections connections are served at the same
+// time on a pool of threads, so that long requests, e.g. with --follow, do not hold up others, further clients wait in
+// the backlog of the socket. Each request may verify several files in parallel with --jobs. SIGINT and SIGTERM stop
+// accepting connections, the server ends once the requests in progress are answered.
+class Server {
+private:
+   // Clients that do not finish their request in time are disconnected
+   static constexpr int requestTimeoutSeconds = 60;
+   static constexpr unsigned maximumConnections = 16;
+
+   // Set by the signal handler, which shuts the listener down to wake up accept
+   static inline volatile sig_atomic_t stopping = 0;
+   static inline int stoppingListener = -1;
+
+   string socketPath;
+   ResultCache cache;
+   int listener;
+   mutex connectionsMutex;
+   condition_variable connectionFinished;
+   unsigned activeConnections = 0;
+
+   static void stop(int) {
+      stopping = 1;
+      shutdown(stoppingListener, SHUT_RDWR);
+   }
+
+   static sockaddr_un addressOf(const string& socketPath) {
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if (socketPath.size() >= sizeof(address.sun_path)) {
+         cerr << socketPath << ": socket path is too long" << endl;
+         exit(EXIT_FAILURE);
+      }
+      strcpy(address.sun_path, socketPath.c_str());
+      return address;
+   }
+
+   // Returns false if the client disconnected or timed out before the empty line
+   static bool readRequest(int client, vector<string>& lines) {
+      string line;
+      char buffer[4096];
+      while (true) {
+         ssize_t count = read(client, buffer, sizeof(buffer));
+         if (count < 0 && errno == EINTR) {
+            continue;
+         }
+         if (count <= 0) {
+            return false;
+         }
+         for (ssize_t character = 0; character != count; ++character) {
+            if (buffer[character] != '\n') {
+               line += buffer[character];
+            } else if (line.empty()) {
+               return !lines.empty();
+            } else {
+               lines.push_back(move(line));
+               line.clear();
+            }
+         }
+      }
+   }
+
+   static string toJson(const vector<pair<string, verify::Result>>& reports) {
+      static const char* kinds[] = {"mismatch", "schema", "file", "options"};
+      string json = "[";
+      for (auto& [file, report] : reports) {
+         json += string(json.size() > 1 ? "," : "") + "{\"file\":\"" + util::escapeJson(file) + "\",\"errors\":[";
+         for (size_t index = 0; index != report.errors.size(); ++index) {
+            auto& error = report.errors[index];
+            json += string(index ? "," : "") + "{\"kind\":\"" + kinds[static_cast<int>(error.kind)] + "\",\"message\":\"" + util::escapeJson(error.message) + "\",\"line\":" + to_string(error.line) + ",\"field\":" + to_string(error.field) + "}";
+         }
+         json += "],\"mismatches\":" + to_string(report.numberOfMismatches) + ",\"mismatches_per_column\":[";
+         for (size_t column = 0; column != report.mismatchesPerColumn.size(); ++column) {
+            json += string(column ? "," : "") + to_string(report.mismatchesPerColumn[column]);
+         }
+         json += "]}";
+      }
+      return json + "]";
+   }
+
+   void handle(int client) {
+      timeval timeout{requestTimeoutSeconds, 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      vector<string> lines;
+      if (!readRequest(client, lines)) {
+         return;
+      }
+      stringstream output;
+      stringstream errors;
+      vector<pair<string, verify::Result>> reports;
+      bool failed = true;
+      bool unverified = false;
+      struct stat statistics;
+      string directory = lines[0];
+      if (find(lines.begin() + 1, lines.end(), "-") != lines.end()) {
+         errors << "the server cannot read results from stdin" << endl;
+      } else if (directory[0] != '/' || stat(directory.c_str(), &statistics) != 0 || !S_ISDIR(statistics.st_mode)) {
+         errors << directory << ": no such directory" << endl;
+      } else {
+         lines[0] = "verify";
+         vector<char*> arguments;
+         for (auto& line : lines) {
+            arguments.push_back(&line[0]);
+         }
+         unique_ptr<Verifier> verifier;
+         try {
+            verifier = make_unique<Verifier>(arguments.size(), arguments.data(), &cache, output, errors, directory);
+            verifier->verify();
+            failed = verifier->failed;
+            unverified = verifier->unverified;
+         } catch (VerificationAborted&) {
+         } catch (exception& e) {
+            errors << e.what() << endl;
+         }
+         if (verifier) {
+            reports = move(verifier->reports);
+         }
+      }
+      writeAll(client, string("{\"failed\":") + (failed ? "true" : "false") + ",\"unverified\":" + (unverified ? "true" : "false") + ",\"output\":\"" + util::escapeJson(output.str()) + "\",\"errors\":\"" + util::escapeJson(errors.str()) + "\",\"results\":" + toJson(reports) + "}\n");
+   }
+
+public:
+   Server(string socketPath, size_t cacheBudget) : socketPath(socketPath), cache(cacheBudget) {
+      sockaddr_un address = addressOf(socketPath);
+      // The socket of an earlier server that was killed
+      struct stat statistics;
+      if (lstat(socketPath.c_str(), &statistics) == 0 && S_ISSOCK(statistics.st_mode)) {
+         unlink(socketPath.c_str());
+      }
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+         cerr << socketPath << ": could not listen on socket" << endl;
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   ~Server() {
+      close(listener);
+      unlink(socketPath.c_str());
+   }
+
+   static bool writeAll(int descriptor, const string& data) {
+      for (size_t written = 0; written != data.size();) {
+         ssize_t count = write(descriptor, data.data() + written, data.size() - written);
+         if (count < 0 && errno == EINTR) {
+            continue;
+         }
+         if (count <= 0) {
+            return false;
+         }
+         written += count;
+      }
+      return true;
+   }
+
+   // Returns after SIGINT or SIGTERM once the requests in progress are answered
+   void run() {
+      // Clients that disconnect before their response must not end the server
+      signal(SIGPIPE, SIG_IGN);
+      stoppingListener = listener;
+      signal(SIGINT, stop);
+      signal(SIGTERM, stop);
+      // Joins the workers when it goes out of scope
+      util::ThreadPool connections(maximumConnections);
+      while (!stopping) {
+         {
+            unique_lock<mutex> lock(connectionsMutex);
+            connectionFinished.wait(lock, [this]() { return activeConnections < maximumConnections; });
+         }
+         int client = accept(listener, nullptr, nullptr);
+         if (client < 0) {
+            if (stopping) {
+               break;
+            }
+            if (errno == EINTR) {
+               continue;
+            }
+            cerr << socketPath << ": could not accept connection" << endl;
+            exit(EXIT_FAILURE);
+         }
+         {
+            lock_guard<mutex> lock(connectionsMutex);
+            ++activeConnections;
+         }
+         connections.schedule([this, client]() {
+            handle(client);
+            close(client);
+            {
+               lock_guard<mutex> lock(connectionsMutex);
+               --activeConnections;
+            }
+            connectionFinished.notify_one();
+         });
+      }
+   }
+
+   // Sends the arguments of verify to the server at socketPath and prints its output and errors, returns the exit code
+   static int request(string socketPath, int argc, char *argv[]) {
+      string request;
+      char* directory = getcwd(nullptr, 0);
+      request = string(directory) + "\n";
+      free(directory);
+      for (int argument = 0; argument != argc; ++argument) {
+         if (!*argv[argument] || strchr(argv[argument], '\n')) {
+            cerr << "arguments for the server must neither be empty nor contain line breaks" << endl;
+            return EXIT_FAILURE;
+         }
+         request += string(argv[argument]) + "\n";
       }
+      request += "\n";
+      sockaddr_un address = addressOf(socketPath);
+      int server = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (server < 0 || connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || !writeAll(server, request)) {
+         cerr << socketPath << ": could not connect to server" << endl;
+         return EXIT_FAILURE;
+      }
+      string response;
+      char buffer[1 << 16];
+      ssize_t count;
+      while ((count = read(server, buffer, sizeof(buffer))) != 0) {
+         if (count < 0 && errno != EINTR) {
+            break;
+         }
+         response.append(buffer, max<ssize_t>(count, 0));
+      }
+      close(server);
+      util::JsonValue value;
+      size_t position = 0;
+      const util::JsonValue* failed = nullptr;
+      const util::JsonValue* unverified = nullptr;
+      const util::JsonValue* output = nullptr;
+      const util::JsonValue* errors = nullptr;
+      if (!util::readJson(response, position, value) || !(failed = value.find("failed")) || failed->type != util::JsonValue::Type::Boolean || !(unverified = value.find("unverified")) || unverified->type != util::JsonValue::Type::Boolean || !(output = value.find("output")) || output->type != util::JsonValue::Type::String || !(errors = value.find("errors")) || errors->type != util::JsonValue::Type::String) {
+         cerr << socketPath << ": malformed response from server" << endl;
+         return EXIT_FAILURE;
+      }
+      cout << output->text << flush;
+      cerr << errors->text << flush;
+      return failed->boolean ? EXIT_FAILURE : unverified->boolean ? exitUnverified : EXIT_SUCCESS;
    }
 };
 //---------------------------------------------------------------------------
 int main(int argc, char *argv[]) {
+   // verify --serve SOCKET [--cache MB] and verify --client SOCKET arguments, anything else is checked by the Verifier
+   if (argc > 2 && strcmp(argv[1], "--client") == 0) {
+      return Server::request(argv[2], argc - 3, argv + 3);
+   }
+   if ((argc == 3 || (argc == 5 && strcmp(argv[3], "--cache") == 0 && atoi(argv[4]) > 0)) && strcmp(argv[1], "--serve") == 0) {
+      Server server(argv[2], argc == 5 ? size_t(atoi(argv[4])) << 20 : size_t(1024) << 20);
+      server.run();
+      return EXIT_SUCCESS;
+   }
    try {
       Verifier verifier(argc, argv);
       verifier.verify();
       if (verifier.failed) {
          return EXIT_FAILURE;
+      } else if (verifier.unverified) {
+         return exitUnverified;
       } else {
          return EXIT_SUCCESS;
       }
+   } catch (util::FileError& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
    } catch (...) {
       return EXIT_FAILURE;
    }